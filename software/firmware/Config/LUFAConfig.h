@@ -61,9 +61,9 @@
 //#define NO_INTERNAL_SERIAL
 #define FIXED_CONTROL_ENDPOINT_SIZE      8
 //#define DEVICE_STATE_AS_GPIOR            0
-#define FIXED_NUM_CONFIGURATIONS         1
+#define FIXED_NUM_CONFIGURATIONS         2
 //#define CONTROL_ONLY_DEVICE
-//#define INTERRUPT_CONTROL_ENDPOINT
+#define INTERRUPT_CONTROL_ENDPOINT
 //#define NO_DEVICE_REMOTE_WAKEUP
 //#define NO_DEVICE_SELF_POWER
 
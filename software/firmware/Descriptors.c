@@ -54,7 +54,7 @@ const USB_Descriptor_Configuration_t PROGMEM BlueBox_ConfigurationDescriptor =
 
 		.TotalConfigurationSize = sizeof(USB_Descriptor_Configuration_t),
 		.TotalInterfaces        = 1,
-		.ConfigurationNumber    = 1,
+		.ConfigurationNumber    = INTERRUPT_CONFIGURATION,
 		.ConfigurationStrIndex  = NO_DESCRIPTOR,
 		.ConfigAttributes       = USB_CONFIG_ATTR_RESERVED,
 		.MaxPowerConsumption    = USB_CONFIG_POWER_MA(500)
@@ -91,6 +91,50 @@ const USB_Descriptor_Configuration_t PROGMEM BlueBox_ConfigurationDescriptor =
 	},
 };
 
+const USB_Descriptor_Configuration_t PROGMEM BlueBox_BulkConfigurationDescriptor =
+{
+	.Config = {
+		.Header                 = {.Size = sizeof(USB_Descriptor_Configuration_Header_t), .Type = DTYPE_Configuration},
+
+		.TotalConfigurationSize = sizeof(USB_Descriptor_Configuration_t),
+		.TotalInterfaces        = 1,
+		.ConfigurationNumber    = BULK_CONFIGURATION,
+		.ConfigurationStrIndex  = NO_DESCRIPTOR,
+		.ConfigAttributes       = USB_CONFIG_ATTR_RESERVED,
+		.MaxPowerConsumption    = USB_CONFIG_POWER_MA(500)
+	},
+
+	.Interface = {
+		.Header                 = {.Size = sizeof(USB_Descriptor_Interface_t), .Type = DTYPE_Interface},
+
+		.InterfaceNumber        = 0,
+		.AlternateSetting       = 0,
+		.TotalEndpoints         = 2,
+		.Class                  = USB_CSCP_VendorSpecificClass,
+		.SubClass               = 0x00,
+		.Protocol               = 0x00,
+		.InterfaceStrIndex      = NO_DESCRIPTOR
+	},
+
+	.DataInEndpoint = {
+		.Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
+
+		.EndpointAddress        = IN_EPADDR,
+		.Attributes             = (EP_TYPE_BULK | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
+		.EndpointSize           = BULK_IN_EPSIZE,
+		.PollingIntervalMS      = 0x00,
+	},
+
+	.DataOutEndpoint = {
+		.Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
+
+		.EndpointAddress        = OUT_EPADDR,
+		.Attributes             = (EP_TYPE_BULK | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
+		.EndpointSize           = BULK_OUT_EPSIZE,
+		.PollingIntervalMS      = 0x00,
+	},
+};
+
 const USB_Descriptor_String_t PROGMEM BlueBox_LanguageString = {
 	.Header                 = {.Size = USB_STRING_LEN(1), .Type = DTYPE_String},
 	.UnicodeString          = {LANGUAGE_ID_ENG}
@@ -149,8 +193,18 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 		Size    = sizeof(USB_Descriptor_Device_t);
 		break;
 	case DTYPE_Configuration:
-		Address = &BlueBox_ConfigurationDescriptor;
-		Size    = sizeof(USB_Descriptor_Configuration_t);
+		switch (DescriptorNumber)
+		{
+			case 0x00:
+				Address = &BlueBox_ConfigurationDescriptor;
+				Size    = sizeof(USB_Descriptor_Configuration_t);
+				break;
+			case 0x01:
+				Address = &BlueBox_BulkConfigurationDescriptor;
+				Size    = sizeof(USB_Descriptor_Configuration_t);
+				break;
+		}
+
 		break;
 	case DTYPE_String:
 		switch (DescriptorNumber)
@@ -187,6 +241,14 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 
 void EVENT_USB_Device_ConfigurationChanged(void)
 {
-	Endpoint_ConfigureEndpoint(IN_EPADDR,  EP_TYPE_INTERRUPT, IN_EPSIZE,  1);
-	Endpoint_ConfigureEndpoint(OUT_EPADDR, EP_TYPE_INTERRUPT, OUT_EPSIZE, 1);
+	switch (USB_Device_ConfigurationNumber) {
+	case INTERRUPT_CONFIGURATION:
+		Endpoint_ConfigureEndpoint(IN_EPADDR,  EP_TYPE_INTERRUPT, IN_EPSIZE,  1);
+		Endpoint_ConfigureEndpoint(OUT_EPADDR, EP_TYPE_INTERRUPT, OUT_EPSIZE, 1);
+		break;
+	case BULK_CONFIGURATION:
+		Endpoint_ConfigureEndpoint(IN_EPADDR,  EP_TYPE_BULK, BULK_IN_EPSIZE,  2);
+		Endpoint_ConfigureEndpoint(OUT_EPADDR, EP_TYPE_BULK, BULK_OUT_EPSIZE, 2);
+		break;
+	}
 }
@@ -31,6 +31,22 @@
 #define IN_EPSIZE	64
 #define OUT_EPSIZE	64
 
+/* Configuration 1 uses single banked interrupt endpoints polled every
+ * millisecond. Configuration 2 uses double banked bulk endpoints, so the
+ * host can move more than one packet per frame in each direction */
+#define INTERRUPT_CONFIGURATION	1
+#define BULK_CONFIGURATION	2
+
+/* The micro only has 176 bytes of endpoint memory, which is not enough
+ * for two double banked 64 byte endpoints */
+#if defined(BBMICRO)
+#define BULK_IN_EPSIZE	32
+#define BULK_OUT_EPSIZE	32
+#else
+#define BULK_IN_EPSIZE	64
+#define BULK_OUT_EPSIZE	64
+#endif
+
 typedef struct {
 	USB_Descriptor_Configuration_Header_t Config;
 	USB_Descriptor_Interface_t Interface;
@@ -38,6 +54,18 @@ typedef struct {
 	USB_Descriptor_Endpoint_t DataOutEndpoint;
 } USB_Descriptor_Configuration_t;
 
+/* Packet size of the data IN endpoint in the active configuration */
+static inline uint8_t data_in_epsize(void)
+{
+	return (USB_Device_ConfigurationNumber == BULK_CONFIGURATION) ? BULK_IN_EPSIZE : IN_EPSIZE;
+}
+
+/* Packet size of the data OUT endpoint in the active configuration */
+static inline uint8_t data_out_epsize(void)
+{
+	return (USB_Device_ConfigurationNumber == BULK_CONFIGURATION) ? BULK_OUT_EPSIZE : OUT_EPSIZE;
+}
+
 uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 				    const uint8_t wIndex,
 				    const void** const DescriptorAddress,
@@ -21,7 +21,6 @@
  * THE SOFTWARE.
  */
 
-#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <avr/sfr_defs.h>
@@ -34,6 +33,10 @@
 #include "bluebox.h"
 #include "ptt.h"
 #include "led.h"
+#include "timer.h"
+
+/* The receiver runs with the LO 100 kHz below the channel */
+#define ADF_RX_IF_FREQ		100000
 
 static adf_conf_t rx_conf, tx_conf;
 static adf_sysconf_t sys_conf;
@@ -48,46 +51,138 @@ enum {
 	ADF_RX
 } adf_state;
 
-enum {
-	ADF_PA_OFF,
-	ADF_PA_ON
-} adf_pa_state;
+/* Last value written to each register. Writes that would not change
+ * the contents are skipped, except for the registers that start an
+ * action on every write (R7 readback, R12 sync word detect). The cache
+ * is invalidated when the chip is powered down */
+#if defined(ADF_REG_CACHE)
+static uint32_t adf_shadow[16];
+static uint16_t adf_shadow_valid = 0;
+#else
+/* Without the cache, the mode switches keep to the registers a
+ * turnaround changes, unless the RX or TX registers were recalculated
+ * or reset since they were last written in full */
+static uint8_t adf_stale;
+#endif
+
+#define ADF_STALE_RX	0x01
+#define ADF_STALE_TX	0x02
+
+/* IF bandwidth the IF filter was last calibrated for */
+static uint8_t adf_cal_if_bw;
+
+/* The register interface is bit-banged, as the ADF7021 pins are not
+ * connected to a hardware serial port on either board. The shift loops
+ * are unrolled so each bit is only a few SBI/CBI instructions */
+#define ADF_CLOCK_OUT_BIT(byte, bit) do {				\
+		ADF_PORT_SCLK &= ~_BV(ADF_SCLK);			\
+		if ((byte) & _BV(bit))					\
+			ADF_PORT_SDATA |= _BV(ADF_SDATA);		\
+		else							\
+			ADF_PORT_SDATA &= ~_BV(ADF_SDATA);		\
+		ADF_PORT_SCLK |= _BV(ADF_SCLK);				\
+	} while (0)
+
+#define ADF_CLOCK_IN_BIT(byte, bit) do {				\
+		ADF_PORT_SCLK |= _BV(ADF_SCLK);				\
+		if (ADF_PORT_IN_SREAD & _BV(ADF_SREAD))			\
+			(byte) |= _BV(bit);				\
+		ADF_PORT_SCLK &= ~_BV(ADF_SCLK);			\
+	} while (0)
+
+static inline void adf_clock_out(uint8_t byte)
+{
+	ADF_CLOCK_OUT_BIT(byte, 7);
+	ADF_CLOCK_OUT_BIT(byte, 6);
+	ADF_CLOCK_OUT_BIT(byte, 5);
+	ADF_CLOCK_OUT_BIT(byte, 4);
+	ADF_CLOCK_OUT_BIT(byte, 3);
+	ADF_CLOCK_OUT_BIT(byte, 2);
+	ADF_CLOCK_OUT_BIT(byte, 1);
+	ADF_CLOCK_OUT_BIT(byte, 0);
+}
+
+static inline uint8_t adf_clock_in(void)
+{
+	uint8_t byte = 0;
+
+	ADF_CLOCK_IN_BIT(byte, 7);
+	ADF_CLOCK_IN_BIT(byte, 6);
+	ADF_CLOCK_IN_BIT(byte, 5);
+	ADF_CLOCK_IN_BIT(byte, 4);
+	ADF_CLOCK_IN_BIT(byte, 3);
+	ADF_CLOCK_IN_BIT(byte, 2);
+	ADF_CLOCK_IN_BIT(byte, 1);
+	ADF_CLOCK_IN_BIT(byte, 0);
+
+	return byte;
+}
 
 void adf_write_reg(adf_reg_t *reg)
 {
-	signed char i, j;
-	unsigned char byte;
+#if defined(ADF_REG_CACHE)
+	uint8_t addr = reg->byte[0] & 0x0F;
+
+	adf_shadow[addr] = reg->whole_reg;
+	adf_shadow_valid |= (1U << addr);
+#endif
 
 	ADF_PORT_SLE &= ~_BV(ADF_SLE);
 	ADF_PORT_SCLK &= ~_BV(ADF_SCLK);
 
 	/* Clock data out MSbit first */
-	for (i=3; i>=0; i--) {
-		byte = reg->byte[i];
-
-		for (j=8; j>0; j--) {
-			ADF_PORT_SCLK &= ~_BV(ADF_SCLK);
-			if (byte & 0x80)
-				ADF_PORT_SDATA |= _BV(ADF_SDATA);
-			else 
-				ADF_PORT_SDATA &= ~_BV(ADF_SDATA);
-			ADF_PORT_SCLK |= _BV(ADF_SCLK);
-			byte += byte;
-		}
-		ADF_PORT_SCLK &= ~_BV(ADF_SCLK);
-	}
+	adf_clock_out(reg->byte[3]);
+	adf_clock_out(reg->byte[2]);
+	adf_clock_out(reg->byte[1]);
+	adf_clock_out(reg->byte[0]);
+	ADF_PORT_SCLK &= ~_BV(ADF_SCLK);
 
 	/* Strobe the latch */
 	ADF_PORT_SLE |= _BV(ADF_SLE);
 	ADF_PORT_SLE |= _BV(ADF_SLE);
 	ADF_PORT_SDATA &= ~_BV(ADF_SDATA);
-	ADF_PORT_SDATA &= ~_BV(ADF_SLE);
+	ADF_PORT_SLE &= ~_BV(ADF_SLE);
+}
+
+/* Write the register only if its contents changed */
+static void adf_update_reg(adf_reg_t *reg)
+{
+#if defined(ADF_REG_CACHE)
+	uint8_t addr = reg->byte[0] & 0x0F;
+
+	if ((adf_shadow_valid & (1U << addr)) && adf_shadow[addr] == reg->whole_reg)
+		return;
+#endif
+
+	adf_write_reg(reg);
+}
+
+static inline void adf_invalidate_reg(uint8_t addr)
+{
+#if defined(ADF_REG_CACHE)
+	adf_shadow_valid &= ~(1U << addr);
+#endif
+}
+
+static inline void adf_invalidate_regs(void)
+{
+#if defined(ADF_REG_CACHE)
+	adf_shadow_valid = 0;
+#else
+	adf_stale = ADF_STALE_RX | ADF_STALE_TX;
+#endif
+}
+
+static inline void adf_mark_stale(uint8_t mode)
+{
+#if !defined(ADF_REG_CACHE)
+	adf_stale |= mode;
+#endif
 }
 
 adf_reg_t adf_read_reg(unsigned int readback_config)
 {
 	adf_reg_t register_value;
-	signed char i, j;
 
 	/* Write readback and ADC control value */
 	register_value.whole_reg = ((readback_config & 0x1F) << 4);
@@ -104,20 +199,11 @@ adf_reg_t adf_read_reg(unsigned int readback_config)
 
 	/* Clock in first bit and discard (DB16 is not used) */
 	ADF_PORT_SCLK |= _BV(ADF_SCLK);
-	unsigned char byte = 0;
 	ADF_PORT_SCLK &= ~_BV(ADF_SCLK);
 
 	/* Clock in data MSbit first */
-	for (i=1; i>=0; i--) {
-		for (j=8; j>0; j--) {
-			ADF_PORT_SCLK |= _BV(ADF_SCLK);
-			byte += byte;
-			if (ADF_PORT_IN_SREAD & _BV(ADF_SREAD))
-				byte |= 1;
-			ADF_PORT_SCLK &= ~_BV(ADF_SCLK);
-		}
-		register_value.byte[i] = byte;
-	}
+	register_value.byte[1] = adf_clock_in();
+	register_value.byte[0] = adf_clock_in();
 
 	ADF_PORT_SCLK |= _BV(ADF_SCLK);
 	ADF_PORT_SLE &= ~_BV(ADF_SLE);
@@ -126,11 +212,60 @@ adf_reg_t adf_read_reg(unsigned int readback_config)
 	return register_value;
 }
 
+/* Average CPU cycles spent on a register write and on a readback. Call
+ * with interrupts disabled, the Timer1 count is read directly */
+void adf_benchmark_regs(uint16_t *write_cycles, uint16_t *read_cycles)
+{
+	adf_reg_t reg;
+	uint16_t start, end;
+	uint8_t i;
+
+	/* Selecting the version readback has no side effects */
+	reg.whole_reg = (ADF_READBACK_VERSION << 4) | 7;
+
+	start = timer_ticks();
+	for (i = 0; i < ADF_BENCHMARK_ROUNDS; i++)
+		adf_write_reg(&reg);
+	end = timer_ticks();
+	*write_cycles = (uint32_t)(end - start) * TIMER_TICK_CYCLES / ADF_BENCHMARK_ROUNDS;
+
+	start = timer_ticks();
+	for (i = 0; i < ADF_BENCHMARK_ROUNDS; i++)
+		adf_read_reg(ADF_READBACK_VERSION);
+	end = timer_ticks();
+	*read_cycles = (uint32_t)(end - start) * TIMER_TICK_CYCLES / ADF_BENCHMARK_ROUNDS;
+}
+
+/* CPU cycles of a clock search for the current RX data rate. It only
+ * works on a copy, so it runs with interrupts enabled. The shortest of
+ * ADF_BENCHMARK_RUNS is the one least disturbed by interrupts */
+uint32_t adf_benchmark_clocks(void)
+{
+	adf_conf_t scratch;
+	uint32_t start, us, best = UINT32_MAX;
+	uint8_t i;
+
+	for (i = 0; i < ADF_BENCHMARK_RUNS; i++) {
+		scratch = rx_conf;
+		start = timer_us();
+		adf_find_clocks(&scratch);
+		us = timer_us() - start;
+		if (us < best)
+			best = us;
+	}
+
+	return best * (F_CPU / 1000000UL);
+}
+
 void adf_set_power_on(unsigned long adf_xtal)
 {
 	/* Store locally the oscillator frequency */
 	sys_conf.adf_xtal = adf_xtal;
 
+	/* Registers are reset by power down */
+	adf_invalidate_regs();
+	adf_cal_if_bw = 0xFF;
+
 	/* Ensure the ADF GPIO port is correctly initialised */
 	ADF_PORT_DIR_SWD 	&= ~_BV(ADF_SWD);
 	ADF_PORT_DIR_SCLK 	|=  _BV(ADF_SCLK);
@@ -182,7 +317,6 @@ void adf_set_power_on(unsigned long adf_xtal)
 	adf_write_reg(&sys_conf.r14_reg);
 
 	adf_state = ADF_ON;
-	adf_pa_state = ADF_PA_OFF;
 }
 
 void adf_set_power_off()
@@ -191,29 +325,44 @@ void adf_set_power_off()
 	ADF_PORT_CE &= ~_BV(ADF_CE);
 
 	adf_state = ADF_OFF;
-	adf_pa_state = ADF_PA_OFF;
+	adf_invalidate_regs();
 }
 
-void adf_find_clocks(adf_conf_t *conf)
+/* Divide and round to nearest */
+static inline uint32_t div_round(uint32_t num, uint32_t den)
 {
-	/* Find desired F.dev. */
-	unsigned char tx_freq_dev = (unsigned char) round( ((double)conf->desired.mod_index * 0.5 * conf->desired.data_rate * 65536.0) / (0.5 * sys_conf.adf_xtal));
-	double freq_dev = (tx_freq_dev * sys_conf.adf_xtal) / 65536.0;
+	return (num + den / 2) / den;
+}
 
-	/* Find K */
-	unsigned int k = round(100000 / (freq_dev));
+/* The clock calculations are done in units of xtal/1024 to keep all
+ * intermediate results within 32 bits. The xtal frequency must thus be
+ * a multiple of 1024 Hz, which is true for the 16 MHz boards. */
+static inline uint32_t adf_xtal_k(void)
+{
+	return sys_conf.adf_xtal >> 10;
+}
 
-	/* Run a variable optimisation for Demod clock divider */
-	int i_dem;
+void adf_find_clocks(adf_conf_t *conf)
+{
+	uint32_t xtal_k = adf_xtal_k();
+	uint32_t data_rate = conf->desired.data_rate;
+	uint16_t k, disc_bw, cdr_clk_divide, data_rate_real, n;
+	uint8_t tx_freq_dev, i_dem;
 	int w_residual = INT16_MAX, residual;
 
-	double demod_clk, data_rate_real;
-	unsigned int cdr_clk_divide, disc_bw;
+	/* Find desired F.dev. in units of xtal/2^16 */
+	tx_freq_dev = div_round(conf->desired.mod_index * data_rate * 64, xtal_k);
+
+	/* Find K = 100 kHz / F.dev. */
+	k = div_round(100000UL * 64, tx_freq_dev * xtal_k);
 
+	/* Run a variable optimisation for Demod clock divider */
 	for (i_dem = 1; i_dem < 15; i_dem++) {
-		demod_clk = (double) sys_conf.adf_xtal / i_dem;
-		disc_bw = round((k * demod_clk) / 400000);
-		cdr_clk_divide = round(demod_clk / ((double)conf->desired.data_rate * 32));
+		/* K * (xtal / i_dem) / 400 kHz */
+		disc_bw = div_round(k * xtal_k * 8, i_dem * 3125UL);
+
+		/* (xtal / i_dem) / (data rate * 32) */
+		cdr_clk_divide = div_round(xtal_k * 32, i_dem * data_rate);
 
 		if (disc_bw > 660)
 			continue;
@@ -221,8 +370,8 @@ void adf_find_clocks(adf_conf_t *conf)
 		if (cdr_clk_divide > 255)
 			continue;
 
-		data_rate_real = (sys_conf.adf_xtal / ((double) i_dem * (double) cdr_clk_divide * 32.0));
-		residual = abs((unsigned int) data_rate_real - conf->desired.data_rate);
+		data_rate_real = (xtal_k * 32) / (i_dem * cdr_clk_divide);
+		residual = abs((int16_t)(data_rate_real - conf->desired.data_rate));
 
 		/* Search for a new winner */
 		if (w_residual > residual) {
@@ -231,21 +380,21 @@ void adf_find_clocks(adf_conf_t *conf)
 		}
 	}
 
-	/* Demodulator clock */
-	demod_clk = (double) sys_conf.adf_xtal / conf->r3.dem_clk_divide;
-
 	/* CDR clock */
-	conf->r3.cdr_clk_divide = (unsigned int) round(demod_clk / ((double)conf->desired.data_rate * 32));
+	conf->r3.cdr_clk_divide = div_round(xtal_k * 32, conf->r3.dem_clk_divide * data_rate);
 
-	/* Data rate and freq. deviation */
-	conf->real.data_rate = (sys_conf.adf_xtal / ((double) conf->r3.dem_clk_divide * (double) conf->r3.cdr_clk_divide * 32.0));
-	conf->real.freq_dev = (unsigned char) round( ((double)conf->desired.mod_index * 0.5 * conf->real.data_rate * 65536.0) / (0.5 * sys_conf.adf_xtal));
+	/* Data rate and freq. deviation, the rate truncated as it always was
+	 * and the deviation taken from it, so R2 is unchanged */
+	n = conf->r3.dem_clk_divide * conf->r3.cdr_clk_divide;
+	conf->real.data_rate = (xtal_k * 32) / n;
+	conf->real.freq_dev = (uint8_t) div_round((uint32_t) conf->desired.mod_index * conf->real.data_rate * 64, xtal_k);
 
 	/* Discriminator bandwidth */
-	conf->r4.disc_bw = round((k * demod_clk) / 400000);
+	conf->r4.disc_bw = div_round(k * xtal_k * 8, conf->r3.dem_clk_divide * 3125UL);
 
-	/* Post demodulation bandwidth */
-	conf->r4.post_demod_bw = round(((conf->real.data_rate * 0.75) * 3.141592654 * 2048.0) / demod_clk);
+	/* Post demodulation bandwidth, real data rate * 0.75 * pi * 2048 / demod clock.
+	 * This reduces to 48 * pi / CDR divider, here with 48 * pi scaled by 10^6. */
+	conf->r4.post_demod_bw = div_round(150796447UL, conf->r3.cdr_clk_divide * 1000000UL);
 
 	/* K odd or even */
 	if (k & 1) { 
@@ -267,17 +416,36 @@ void adf_find_clocks(adf_conf_t *conf)
 	}
 }
 
+/* Find the fractional-N divider for a given frequency with the PFD at xtal/2 */
+static void adf_find_n(adf_conf_t *conf, uint32_t freq)
+{
+	uint32_t pfd = sys_conf.adf_xtal / 2;
+	uint32_t n_int = freq / pfd;
+	uint32_t n_frac = div_round((freq % pfd) * 64, adf_xtal_k());
+
+	/* Carry if the fraction rounded up to a whole */
+	if (n_frac == 32768) {
+		n_int++;
+		n_frac = 0;
+	}
+
+	conf->r0.int_n = n_int;
+	conf->r0.frac_n = n_frac;
+}
+
 void adf_init_rx_mode(unsigned int data_rate, uint8_t mod_index, unsigned long freq, uint8_t if_bw)
 {
-	/* Calculate the RX clocks */
-	rx_conf.desired.data_rate = data_rate;
-	rx_conf.desired.mod_index = mod_index;
+	/* Calculate the RX clocks, unless only the frequency changed */
+	if (rx_conf.desired.data_rate != data_rate || rx_conf.desired.mod_index != mod_index) {
+		rx_conf.desired.data_rate = data_rate;
+		rx_conf.desired.mod_index = mod_index;
+		adf_find_clocks(&rx_conf);
+	}
 	rx_conf.desired.freq = freq;
-	adf_find_clocks(&rx_conf);
 
 	/* Setup RX Clocks */
-	rx_conf.r3.seq_clk_divide = round(sys_conf.adf_xtal / 100000.0);
-	rx_conf.r3.agc_clk_divide = round((rx_conf.r3.seq_clk_divide * sys_conf.adf_xtal) / 10000.0);
+	rx_conf.r3.seq_clk_divide = div_round(sys_conf.adf_xtal, 100000);
+	rx_conf.r3.agc_clk_divide = div_round(rx_conf.r3.seq_clk_divide * sys_conf.adf_xtal, 10000);
 	rx_conf.r3.bbos_clk_divide = 2; // 16
 	rx_conf.r3.address_bits = 3;
 
@@ -287,47 +455,41 @@ void adf_init_rx_mode(unsigned int data_rate, uint8_t mod_index, unsigned long f
 	rx_conf.r5.address_bits = 5;
 
 	/* write R0, turn on PLL */
-	double n = ((freq-100000) / (sys_conf.adf_xtal * 0.5));
-	unsigned long n_int = floor(n);
-	unsigned long n_frac = round((n - floor(n)) * 32768);
-
+	adf_find_n(&rx_conf, freq - ADF_RX_IF_FREQ);
 	rx_conf.r0.rx_on = 1;
 	rx_conf.r0.uart_mode = 1;
 	rx_conf.r0.muxout = 2;
-	rx_conf.r0.int_n = n_int;
-	rx_conf.r0.frac_n = n_frac;
 	rx_conf.r0.address_bits = 0;
 
 	/* write R4, turn on demodulation */
 	rx_conf.r4.demod_scheme = 1;
 	rx_conf.r4.if_bw = if_bw;	// 0 = 12.5, 1 = 18.75, 2 = 25 KHz
 	rx_conf.r4.address_bits = 4;
+
+	adf_mark_stale(ADF_STALE_RX);
 }
 
 void adf_init_tx_mode(unsigned int data_rate, uint8_t mod_index, unsigned long freq)
 {
-	/* Calculate the RX clocks */
-	tx_conf.desired.data_rate = data_rate;
-	tx_conf.desired.mod_index = mod_index;
+	/* Calculate the TX clocks, unless only the frequency changed */
+	if (tx_conf.desired.data_rate != data_rate || tx_conf.desired.mod_index != mod_index) {
+		tx_conf.desired.data_rate = data_rate;
+		tx_conf.desired.mod_index = mod_index;
+		adf_find_clocks(&tx_conf);
+	}
 	tx_conf.desired.freq = freq;
-	adf_find_clocks(&tx_conf);
 
 	/* Setup default R3 values */
-	tx_conf.r3.seq_clk_divide = round(sys_conf.adf_xtal / 100000.0);
-	tx_conf.r3.agc_clk_divide = round((tx_conf.r3.seq_clk_divide * sys_conf.adf_xtal) / 10000.0);
+	tx_conf.r3.seq_clk_divide = div_round(sys_conf.adf_xtal, 100000);
+	tx_conf.r3.agc_clk_divide = div_round(tx_conf.r3.seq_clk_divide * sys_conf.adf_xtal, 10000);
 	tx_conf.r3.bbos_clk_divide = 2; // 16
 	tx_conf.r3.address_bits = 3;
 
 	/* write R0, turn on PLL */
-	double n = (freq / (sys_conf.adf_xtal * 0.5));
-	unsigned long n_int = floor(n);
-	unsigned long n_frac = round((n - floor(n)) * 32768);
-
+	adf_find_n(&tx_conf, freq);
 	tx_conf.r0.rx_on = 0;
 	tx_conf.r0.uart_mode = 1;
 	tx_conf.r0.muxout = 2;
-	tx_conf.r0.int_n = n_int;
-	tx_conf.r0.frac_n = n_frac;
 	tx_conf.r0.address_bits = 0;
 
 	/* Set the calcualted frequency deviation */
@@ -341,8 +503,7 @@ void adf_init_tx_mode(unsigned int data_rate, uint8_t mod_index, unsigned long f
 	tx_conf.r2.modulation_scheme = 1;   // 0 = FSK, 1 = GFSK, 5 = RCFSK
 	tx_conf.r2.address_bits = 2;
 
-	/* Ensure rewrite of PA register */
-	adf_pa_state = ADF_PA_OFF;
+	adf_mark_stale(ADF_STALE_TX);
 }
 
 void adf_afc_on(unsigned char range, unsigned char ki, unsigned char kp)
@@ -354,19 +515,19 @@ void adf_afc_on(unsigned char range, unsigned char ki, unsigned char kp)
 	sys_conf.r10.kp = kp;
 	sys_conf.r10.afc_range = range;
 	sys_conf.r10.address_bits = 10;
-	adf_write_reg(&sys_conf.r10_reg);
+	adf_update_reg(&sys_conf.r10_reg);
 }
 
 void adf_afc_off(void)
 {
 	sys_conf.r10.afc_en = 0;
-	adf_write_reg(&sys_conf.r10_reg);
+	adf_update_reg(&sys_conf.r10_reg);
 }
 
 void adf_set_tx_power(char pasetting)
 {
 	tx_conf.r2.power_amplifier = pasetting;
-	adf_write_reg(&tx_conf.r2_reg);
+	adf_update_reg(&tx_conf.r2_reg);
 }
 
 void adf_set_rx_sync_word(unsigned long word, unsigned char len, unsigned char error_tolerance)
@@ -379,7 +540,7 @@ void adf_set_rx_sync_word(unsigned long word, unsigned char len, unsigned char e
 	register_value.whole_reg |= word << 8;
 	register_value.whole_reg |= error_tolerance << 6;
 	register_value.whole_reg |= len << 4;
-	adf_write_reg(&register_value);
+	adf_update_reg(&register_value);
 
 	/* write R12, start sync word detect */
 	adf_set_threshold_free();
@@ -397,68 +558,117 @@ void adf_set_threshold_free(void)
 
 void adf_set_rx_mode(void)
 {
-	if (adf_state == ADF_TX) {
+#if defined(ADF_REG_CACHE)
+	/* Writing R5 starts an IF filter calibration, which is only
+	 * needed after power up and when the IF bandwidth changes */
+	if (rx_conf.r4.if_bw != adf_cal_if_bw) {
+		adf_invalidate_reg(5);
+		adf_cal_if_bw = rx_conf.r4.if_bw;
+	}
+
+	adf_update_reg(&rx_conf.r3_reg);
+	adf_update_reg(&rx_conf.r5_reg);
+	adf_update_reg(&rx_conf.r0_reg);
+	adf_update_reg(&rx_conf.r4_reg);
+#else
+	if (adf_state == ADF_TX && !(adf_stale & ADF_STALE_RX)) {
 		if (rx_conf.r3_reg.whole_reg != tx_conf.r3_reg.whole_reg)
 			adf_write_reg(&rx_conf.r3_reg);
 		adf_write_reg(&rx_conf.r0_reg);
 	} else {
 		adf_write_reg(&rx_conf.r3_reg);
-		adf_write_reg(&rx_conf.r5_reg);
+		if (rx_conf.r4.if_bw != adf_cal_if_bw) {
+			adf_write_reg(&rx_conf.r5_reg);
+			adf_cal_if_bw = rx_conf.r4.if_bw;
+		}
 		adf_write_reg(&rx_conf.r0_reg);
 		adf_write_reg(&rx_conf.r4_reg);
+		adf_stale &= ~ADF_STALE_RX;
 	}
+#endif
 
 	led_off(LED_TRANSMIT);
-	ptt_low(conf.ptt_delay_low);
 
 	adf_state = ADF_RX;
 }
 
 void adf_set_tx_mode(void)
 {
-	/* Turn on PA the first time we transmit */
-	if (adf_pa_state == ADF_PA_OFF) {
+#if defined(ADF_REG_CACHE)
+	/* The PA is set up the first time we transmit */
+	adf_update_reg(&tx_conf.r2_reg);
+
+	led_on(LED_TRANSMIT);
+
+	adf_update_reg(&tx_conf.r3_reg);
+	adf_update_reg(&tx_conf.r0_reg);
+#else
+	if (adf_stale & ADF_STALE_TX) {
 		adf_write_reg(&tx_conf.r2_reg);
-		adf_pa_state = ADF_PA_ON;
+		adf_stale &= ~ADF_STALE_TX;
 	}
 
-	ptt_high(conf.ptt_delay_high);
 	led_on(LED_TRANSMIT);
 
-	if (adf_state == ADF_RX) {
-		if (rx_conf.r3_reg.whole_reg != tx_conf.r3_reg.whole_reg)
-			adf_write_reg(&tx_conf.r3_reg);
-		adf_write_reg(&tx_conf.r0_reg);
-	} else {
+	if (adf_state != ADF_RX || rx_conf.r3_reg.whole_reg != tx_conf.r3_reg.whole_reg)
 		adf_write_reg(&tx_conf.r3_reg);
-		adf_write_reg(&tx_conf.r0_reg);
-	}
+	adf_write_reg(&tx_conf.r0_reg);
+#endif
 
 	adf_state = ADF_TX;
 }
 
+/* Retune RX and TX without touching anything else than the N divider.
+ * Only R0 of the current mode is written */
+void adf_set_frequency(uint32_t rx_freq, uint32_t tx_freq)
+{
+	rx_conf.desired.freq = rx_freq;
+	adf_find_n(&rx_conf, rx_freq - ADF_RX_IF_FREQ);
+	tx_conf.desired.freq = tx_freq;
+	adf_find_n(&tx_conf, tx_freq);
+
+	if (adf_state == ADF_RX)
+		adf_update_reg(&rx_conf.r0_reg);
+	else if (adf_state == ADF_TX)
+		adf_update_reg(&tx_conf.r0_reg);
+}
+
+bool adf_in_rx_mode(void)
+{
+	return adf_state == ADF_RX;
+}
+
 unsigned int adf_readback_version(void)
 {
-	adf_reg_t readback = adf_read_reg(0x1C);
+	adf_reg_t readback = adf_read_reg(ADF_READBACK_VERSION);
 	return readback.word.lower;
 }
 
-signed int adf_readback_rssi(void)
+static const uint8_t gain_correction[] PROGMEM = { 86, 0, 0, 0, 58, 38, 24, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+signed int adf_convert_rssi(adf_reg_t readback)
 {
-	unsigned char gain_correction[] = { 86, 0, 0, 0, 58, 38, 24, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-	adf_reg_t readback = adf_read_reg(0x14);
+	uint8_t rssi = readback.byte[0] & 0x7F;
+	uint8_t gc = (readback.word.lower & 0x780) >> 7;
+
+	/* (RSSI + gain correction) * 0.5 - 130 dBm, rounded. The result is
+	 * always negative so rounding half away from zero is a floor. */
+	return ((rssi + pgm_read_byte(&gain_correction[gc])) >> 1) - 130;
+}
 
-	char rssi = readback.byte[0] & 0x7F;
-	int gc = (readback.word.lower & 0x780) >> 7;
-	double dbm = ((rssi + gain_correction[gc]) * 0.5) - 130;
+signed int adf_convert_afc(adf_reg_t readback)
+{
+	return 100000L - (int32_t)readback.word.lower * ((uint32_t)XTAL_FREQ >> 18);
+}
 
-	return round(dbm);
+signed int adf_readback_rssi(void)
+{
+	return adf_convert_rssi(adf_read_reg(ADF_READBACK_RSSI));
 }
 
-int adf_readback_afc(void)
+signed int adf_readback_afc(void)
 {
-	adf_reg_t readback = adf_read_reg(0x10);
-	return 100000 - round(readback.word.lower * ((uint32_t)XTAL_FREQ >> 18));
+	return adf_convert_afc(adf_read_reg(ADF_READBACK_AFC));
 }
 
 signed int adf_readback_temp(void)
@@ -468,11 +678,15 @@ signed int adf_readback_temp(void)
 	register_value.whole_reg = 8;
 	register_value.whole_reg &= 1 << 8;
 
-	adf_reg_t readback = adf_read_reg(0x16);
-	return round(-40 + ((68.4 - (readback.byte[0] & 0x7F)) * 9.32));
+	adf_reg_t readback = adf_read_reg(ADF_READBACK_TEMP);
+
+	/* -40 + (68.4 - ADC) * 9.32 in millidegrees, rounded */
+	int32_t temp = 597488L - 9320L * (readback.byte[0] & 0x7F);
+	return (temp + (temp < 0 ? -500 : 500)) / 1000;
 }
 
-float adf_readback_voltage(void)
+/* Returns the battery voltage in mV */
+unsigned int adf_readback_voltage(void)
 {
 	/* Enable ADC */
 	adf_reg_t register_value;
@@ -480,8 +694,8 @@ float adf_readback_voltage(void)
 	register_value.whole_reg &= 1 << 8;
 	adf_write_reg(&register_value);
 
-	adf_reg_t readback = adf_read_reg(0x15);
-	return (readback.byte[0] & 0x7F) / 21.1;
+	adf_reg_t readback = adf_read_reg(ADF_READBACK_VOLTAGE);
+	return div_round((readback.byte[0] & 0x7F) * 10000UL, 211);
 }
 
 void adf_test_tx(int mode)
@@ -507,6 +721,7 @@ void adf_configure(void)
 	adf_init_tx_mode(conf.bitrate, conf.modindex, conf.tx_freq);
 	adf_afc_on(conf.afc_range, conf.afc_ki, conf.afc_kp);
 	adf_set_rx_mode();
+	ptt_release(NULL);
 }
 
 void adf_reset(void)
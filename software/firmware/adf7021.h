@@ -99,6 +99,12 @@
 #define ADF_CE 			5
 #endif
 
+/* Skip register writes that would not change the contents. The micro
+ * does not have the RAM for the 64 byte cache */
+#if !defined(BBMICRO)
+#define ADF_REG_CACHE
+#endif
+
 typedef union
 {
 	unsigned long whole_reg;
@@ -111,15 +117,13 @@ typedef union
 
 typedef struct {
 	struct {
-		double data_rate;
-		double mod_index;
-		unsigned long freq;
+		uint16_t data_rate;
+		uint8_t mod_index;
+		uint32_t freq;
 	} desired;
 	struct {
-		double data_rate;
-		double mod_index;
-		unsigned long freq;
-		unsigned int freq_dev;
+		uint16_t data_rate;
+		uint8_t freq_dev;
 	} real;
 	union {
 		adf_reg_t r0_reg;
@@ -269,6 +273,17 @@ typedef struct {
 void adf_write_reg(adf_reg_t *reg);
 adf_reg_t adf_read_reg(unsigned int readback_config);
 
+/* Number of accesses averaged by adf_benchmark_regs() */
+#define ADF_BENCHMARK_ROUNDS	16
+
+/* Number of clock searches adf_benchmark_clocks() takes the fastest of */
+#define ADF_BENCHMARK_RUNS	4
+
+void adf_find_clocks(adf_conf_t *conf);
+
+void adf_benchmark_regs(uint16_t *write_cycles, uint16_t *read_cycles);
+uint32_t adf_benchmark_clocks(void);
+
 void adf_set_power_on(unsigned long adf_xtal);
 void adf_set_power_off(void);
 
@@ -276,6 +291,8 @@ void adf_init_rx_mode(unsigned int data_rate, uint8_t mod_index, unsigned long f
 void adf_init_tx_mode(unsigned int data_rate, uint8_t mod_index, unsigned long freq);
 void adf_set_rx_mode(void);
 void adf_set_tx_mode(void);
+bool adf_in_rx_mode(void);
+void adf_set_frequency(uint32_t rx_freq, uint32_t tx_freq);
 
 void adf_afc_on(unsigned char range, unsigned char ki, unsigned char kp);
 void adf_afc_off(void);
@@ -304,11 +321,20 @@ void adf_set_threshold_free(void);
 void adf_test_tx(int mode);
 void adf_test_off(void);
 
+/* Readback select values for adf_read_reg() */
+#define ADF_READBACK_AFC		0x10
+#define ADF_READBACK_RSSI		0x14
+#define ADF_READBACK_VOLTAGE		0x15
+#define ADF_READBACK_TEMP		0x16
+#define ADF_READBACK_VERSION		0x1C
+
 unsigned int adf_readback_version(void);
+signed int adf_convert_rssi(adf_reg_t readback);
+signed int adf_convert_afc(adf_reg_t readback);
 signed int adf_readback_rssi(void);
 signed int adf_readback_afc(void);
 signed int adf_readback_temp(void);
-float adf_readback_voltage(void);
+unsigned int adf_readback_voltage(void);
 void adf_configure(void);
 void adf_reset(void);
 
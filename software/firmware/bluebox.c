@@ -23,6 +23,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <avr/pgmspace.h>
 
 #include "bluebox.h"
 #include "adf7021.h"
@@ -30,13 +31,32 @@
 #include "spi.h"
 #include "led.h"
 #include "ptt.h"
+#include "timer.h"
+#include "csma.h"
+#include "doppler.h"
+#include "stats.h"
+#include "profile.h"
+#include "sched.h"
 
 #define rf_config_single(_type, _name) 						\
 	_type _name; 								\
 	if (direction == ENDPOINT_DIR_OUT) {					\
 		Endpoint_Read_Control_Stream_LE(&_name, sizeof(_name));		\
-		conf._name = _name;						\
+		cli();								\
+		staged._name = _name;						\
 		conf_set_reconf();						\
+		sei();								\
+	} else if (direction == ENDPOINT_DIR_IN) {				\
+		Endpoint_Write_Control_Stream_LE(&staged._name, sizeof(staged._name)); \
+	}
+
+#define rf_counter_single(_type, _name) 					\
+	_type _name; 								\
+	if (direction == ENDPOINT_DIR_OUT) {					\
+		Endpoint_Read_Control_Stream_LE(&_name, sizeof(_name));		\
+		cli();								\
+		conf._name = _name;						\
+		sei();								\
 	} else if (direction == ENDPOINT_DIR_IN) {				\
 		Endpoint_Write_Control_Stream_LE(&conf._name, sizeof(conf._name)); \
 	}
@@ -46,6 +66,11 @@ struct bluebox_config conf = {
 	.tx_freq = FREQUENCY,
 	.rx_freq = FREQUENCY,
 	.csma_rssi = CSMA_RSSI,
+	.csma_hyst = CSMA_HYSTERESIS,
+	.csma_persist = CSMA_PERSISTENCE,
+	.csma_slot_ms = CSMA_SLOT_MS,
+	.csma_be_min = CSMA_BE_MIN,
+	.csma_be_max = CSMA_BE_MAX,
 	.bitrate = BAUD_RATE,
 	.modindex = MOD_INDEX,
 	.pa_setting = PA_SETTING,
@@ -66,10 +91,33 @@ struct bluebox_config conf = {
 	.ptt_delay_high = PTT_DELAY_HIGH,
 	.ptt_delay_low = PTT_DELAY_LOW,
 	.tx = 0,
+	.tx_timestamp = 0,
 	.rx = 0,
+	.csma_deferrals = 0,
+	.csma_busy_ms = 0,
 	.fw_revision = FW_REVISION,
 };
 
+/* Requests only write the staged image. conf_task() copies it into conf
+ * between frames, so the SPI interrupt never sees a half-applied
+ * configuration. The sequence numbers tell the host when that happened */
+static struct config_image staged;
+static uint16_t staged_seq;
+static uint16_t active_seq;
+
+/* Data stage of the larger control requests. They run from USB_COM_vect
+ * on top of whatever it interrupted, so the data is kept off the stack.
+ * The control endpoint interrupt stays disabled while a request is
+ * handled, so one buffer serves them all */
+static union {
+	struct bluebox_stats stats;
+	struct config_image config;
+	struct doppler_step steps[DOPPLER_CHUNK];
+#if defined(BLUEBOX_PROFILE)
+	struct profile_request profile;
+#endif
+} ctrl_buf;
+
 static inline bool conf_should_reconf(void)
 {
 	return (conf.flags & CONF_FLAG_RECONFIGURE);
@@ -78,6 +126,8 @@ static inline bool conf_should_reconf(void)
 static inline void conf_set_reconf(void)
 {
 	conf.flags |= CONF_FLAG_RECONFIGURE;
+	staged_seq++;
+	sched_post(EVENT_CONF);
 }
 
 static inline void conf_clear_reconf(void)
@@ -85,6 +135,8 @@ static inline void conf_clear_reconf(void)
 	conf.flags &= ~CONF_FLAG_RECONFIGURE;
 }
 
+struct bluebox_stats stats;
+
 uint32_t serialno __attribute__((section(".eeprom")));
 
 static void setup_hardware(void)
@@ -95,6 +147,7 @@ static void setup_hardware(void)
 	clock_prescale_set(clock_div_1);
 
 	ptt_init();
+	timer_init();
 	USB_Init();
 	led_init();
 
@@ -122,20 +175,212 @@ static void do_register(int direction, unsigned int regnum)
 		Endpoint_Read_Control_Stream_LE(&value, sizeof(value));
 		value = (value & ~0xf) | (regnum & 0xf);
 		reg.whole_reg = value;
+		cli();
 		adf_write_reg(&reg);
+		sei();
 	} else if (direction == ENDPOINT_DIR_IN) {
+		cli();
 		reg = adf_read_reg(regnum);
+		sei();
 		value = reg.whole_reg;
 		Endpoint_Write_Control_Stream_LE(&value, sizeof(value));
 	}
 }
 
+/* CPU cycles spent in the last adf_configure() from conf_task() */
+static uint32_t configure_cycles;
+
+struct benchmark_request {
+	uint16_t write_cycles;
+	uint16_t read_cycles;
+	uint32_t clocks_cycles;
+	uint32_t configure_cycles;
+} __attribute__ ((packed));
+
+static void do_reg_benchmark(int direction, unsigned int vWalue)
+{
+	struct benchmark_request req;
+	uint16_t write_cycles = 0, read_cycles = 0;
+	uint32_t clocks_cycles;
+
+	if (direction == ENDPOINT_DIR_IN) {
+		/* The register accesses keep interrupts off for a while,
+		 * so they are skipped while a frame is in progress */
+		cli();
+		if (!spi_busy())
+			adf_benchmark_regs(&write_cycles, &read_cycles);
+		sei();
+		clocks_cycles = adf_benchmark_clocks();
+		req.write_cycles = write_cycles;
+		req.read_cycles = read_cycles;
+		req.clocks_cycles = clocks_cycles;
+		req.configure_cycles = configure_cycles;
+		Endpoint_Write_Control_Stream_LE(&req, sizeof(req));
+	}
+}
+
+static void do_doppler_table(int direction, unsigned int wValue)
+{
+	struct doppler_step *steps = ctrl_buf.steps;
+	struct doppler_status status;
+	uint8_t i, n;
+
+	if (direction == ENDPOINT_DIR_OUT) {
+		/* wValue is the index of the first step. Anything but a
+		 * whole number of steps, at most DOPPLER_CHUNK, is stalled */
+		if (USB_ControlRequest.wLength > sizeof(ctrl_buf.steps) ||
+		    USB_ControlRequest.wLength % sizeof(steps[0])) {
+			Endpoint_StallTransaction();
+			return;
+		}
+		n = USB_ControlRequest.wLength / sizeof(steps[0]);
+		Endpoint_Read_Control_Stream_LE(steps, n * sizeof(steps[0]));
+		cli();
+		for (i = 0; i < n; i++)
+			if (!doppler_load(wValue + i, &steps[i]))
+				break;
+		sei();
+	} else if (direction == ENDPOINT_DIR_IN) {
+		cli();
+		doppler_get_status(&status);
+		sei();
+		Endpoint_Write_Control_Stream_LE(&status, sizeof(status));
+	}
+}
+
+static void do_doppler_ctrl(int direction, unsigned int wValue)
+{
+	if (direction == ENDPOINT_DIR_OUT) {
+		cli();
+		if (wValue != 0)
+			doppler_start();
+		else
+			doppler_stop();
+		sei();
+	}
+}
+
+static uint8_t config_status = CONFIG_STATUS_OK;
+
+#define config_copy(_dst, _src, _name)	((_dst)->_name = (_src)->_name)
+
+#define config_copy_all(_dst, _src) do {			\
+		config_copy(_dst, _src, tx_freq);		\
+		config_copy(_dst, _src, rx_freq);		\
+		config_copy(_dst, _src, csma_rssi);		\
+		config_copy(_dst, _src, csma_hyst);		\
+		config_copy(_dst, _src, csma_persist);		\
+		config_copy(_dst, _src, csma_slot_ms);		\
+		config_copy(_dst, _src, csma_be_min);		\
+		config_copy(_dst, _src, csma_be_max);		\
+		config_copy(_dst, _src, bitrate);		\
+		config_copy(_dst, _src, modindex);		\
+		config_copy(_dst, _src, pa_setting);		\
+		config_copy(_dst, _src, afc_range);		\
+		config_copy(_dst, _src, afc_ki);		\
+		config_copy(_dst, _src, afc_kp);		\
+		config_copy(_dst, _src, afc_enable);		\
+		config_copy(_dst, _src, if_bw);			\
+		config_copy(_dst, _src, sw);			\
+		config_copy(_dst, _src, swtol);			\
+		config_copy(_dst, _src, swlen);			\
+		config_copy(_dst, _src, do_rs);			\
+		config_copy(_dst, _src, do_viterbi);		\
+		config_copy(_dst, _src, training_symbol);	\
+		config_copy(_dst, _src, training_ms);		\
+		config_copy(_dst, _src, training_inter_ms);	\
+		memcpy((_dst)->callsign, (_src)->callsign, CALLSIGN_LENGTH); \
+		config_copy(_dst, _src, ptt_delay_high);	\
+		config_copy(_dst, _src, ptt_delay_low);		\
+	} while (0)
+
+static bool config_valid(struct config_image *img)
+{
+	if (img->tx_freq < CONFIG_FREQ_MIN || img->tx_freq > CONFIG_FREQ_MAX)
+		return false;
+	if (img->rx_freq < CONFIG_FREQ_MIN || img->rx_freq > CONFIG_FREQ_MAX)
+		return false;
+	if (img->bitrate < CONFIG_BITRATE_MIN || img->bitrate > CONFIG_BITRATE_MAX)
+		return false;
+	if (!img->modindex || img->pa_setting > CONFIG_PA_MAX || img->if_bw > CONFIG_IF_BW_MAX)
+		return false;
+	if (img->swlen > ADF_SYNC_WORD_LEN_24 || img->swtol > ADF_SYNC_WORD_ERROR_TOLERANCE_3)
+		return false;
+	if (img->csma_be_max > CSMA_BE_LIMIT || img->csma_be_min > img->csma_be_max)
+		return false;
+
+	return true;
+}
+
+/* Read or write the whole staged configuration in one transfer. A valid
+ * image is applied as a single reconfiguration by conf_task() once no
+ * frame is in progress. The status of the last write is returned on read */
+static void do_config(int direction, unsigned int vWalue)
+{
+	struct config_image *img = &ctrl_buf.config;
+
+	if (direction == ENDPOINT_DIR_OUT) {
+		/* Only a whole image is taken, anything else is stalled */
+		if (USB_ControlRequest.wLength != sizeof(*img)) {
+			config_status = CONFIG_STATUS_LENGTH;
+			Endpoint_StallTransaction();
+			return;
+		}
+		Endpoint_Read_Control_Stream_LE(img, sizeof(*img));
+
+		if (img->version != CONFIG_VERSION) {
+			config_status = CONFIG_STATUS_VERSION;
+		} else if (!config_valid(img)) {
+			config_status = CONFIG_STATUS_VALUE;
+		} else {
+			cli();
+			config_copy_all(&staged, img);
+			conf_set_reconf();
+			sei();
+			config_status = CONFIG_STATUS_OK;
+		}
+	} else if (direction == ENDPOINT_DIR_IN) {
+		img->version = CONFIG_VERSION;
+		img->status = config_status;
+		config_copy_all(img, &staged);
+		Endpoint_Write_Control_Stream_LE(img, sizeof(*img));
+	}
+}
+
+struct config_seq {
+	uint16_t staged;
+	uint16_t active;
+} __attribute__ ((packed));
+
+/* The staged configuration has taken effect once active equals the
+ * staged value read back after the last write */
+static void do_config_seq(int direction, unsigned int vWalue)
+{
+	struct config_seq seq;
+
+	if (direction == ENDPOINT_DIR_IN) {
+		cli();
+		seq.staged = staged_seq;
+		seq.active = active_seq;
+		sei();
+		Endpoint_Write_Control_Stream_LE(&seq, sizeof(seq));
+	}
+}
+
+/* Ignored while a frame is sent or received. The SPI code owns the PTT
+ * sequence then, and replacing its callback would leave it waiting */
 static void do_rxtx_mode(int direction, unsigned int wValue)
 {
-	if (wValue != 0)
-		adf_set_tx_mode();
-	else
-		adf_set_rx_mode();
+	cli();
+	if (!spi_busy()) {
+		if (wValue != 0) {
+			ptt_key(adf_set_tx_mode);
+		} else {
+			adf_set_rx_mode();
+			ptt_release(NULL);
+		}
+	}
+	sei();
 }
 
 static void do_tx_frequency(int direction, unsigned int vWalue)
@@ -154,11 +399,13 @@ static void do_frequency(int direction, unsigned int wValue)
 
 	if (direction == ENDPOINT_DIR_OUT) {
 		Endpoint_Read_Control_Stream_LE(&freq, sizeof(freq));
-		conf.tx_freq = freq;
-		conf.rx_freq = freq;
+		cli();
+		staged.tx_freq = freq;
+		staged.rx_freq = freq;
 		conf_set_reconf();
+		sei();
 	} else if (direction == ENDPOINT_DIR_IN) {
-		Endpoint_Write_Control_Stream_LE(&conf.rx_freq, sizeof(conf.rx_freq)); \
+		Endpoint_Write_Control_Stream_LE(&staged.rx_freq, sizeof(staged.rx_freq)); \
 	}
 }
 
@@ -172,6 +419,66 @@ static void do_csma_rssi(int direction, unsigned int vWalue)
 	rf_config_single(int16_t, csma_rssi);
 }
 
+struct csma_request {
+	uint8_t hysteresis;
+	uint8_t persistence;
+	uint8_t slot_ms;
+	uint8_t be_min;
+	uint8_t be_max;
+} __attribute__ ((packed));
+
+static void do_csma_params(int direction, unsigned int vWalue)
+{
+	struct csma_request req;
+
+	if (direction == ENDPOINT_DIR_OUT) {
+		Endpoint_Read_Control_Stream_LE(&req, sizeof(req));
+		cli();
+		staged.csma_hyst = req.hysteresis;
+		staged.csma_persist = req.persistence;
+		staged.csma_slot_ms = req.slot_ms;
+		staged.csma_be_max = req.be_max < CSMA_BE_LIMIT ? req.be_max : CSMA_BE_LIMIT;
+		staged.csma_be_min = req.be_min < staged.csma_be_max ? req.be_min : staged.csma_be_max;
+		conf_set_reconf();
+		sei();
+	} else if (direction == ENDPOINT_DIR_IN) {
+		req.hysteresis = staged.csma_hyst;
+		req.persistence = staged.csma_persist;
+		req.slot_ms = staged.csma_slot_ms;
+		req.be_min = staged.csma_be_min;
+		req.be_max = staged.csma_be_max;
+		Endpoint_Write_Control_Stream_LE(&req, sizeof(req));
+	}
+}
+
+struct csma_stats {
+	uint32_t deferrals;
+	uint32_t busy_ms;
+	int16_t rssi;
+	uint8_t busy;
+} __attribute__ ((packed));
+
+static void do_csma_stats(int direction, unsigned int vWalue)
+{
+	struct csma_stats cs;
+
+	if (direction == ENDPOINT_DIR_OUT) {
+		Endpoint_Read_Control_Stream_LE(&cs, sizeof(cs));
+		cli();
+		conf.csma_deferrals = cs.deferrals;
+		conf.csma_busy_ms = cs.busy_ms;
+		sei();
+	} else if (direction == ENDPOINT_DIR_IN) {
+		cli();
+		cs.deferrals = conf.csma_deferrals;
+		cs.busy_ms = conf.csma_busy_ms;
+		sei();
+		cs.rssi = csma_rssi_average();
+		cs.busy = csma_channel_busy();
+		Endpoint_Write_Control_Stream_LE(&cs, sizeof(cs));
+	}
+}
+
 static void do_power(int direction, unsigned int vWalue)
 {
 	rf_config_single(uint8_t, pa_setting);
@@ -190,16 +497,18 @@ static void do_acf(int direction, unsigned int vWalue)
 
 	if (direction == ENDPOINT_DIR_OUT) {
 		Endpoint_Read_Control_Stream_LE(&req, sizeof(req));
-		conf.afc_enable = !!req.state;
-		conf.afc_range = req.range ? req.range : conf.afc_range;
-		conf.afc_kp = req.p ? req.p : conf.afc_kp;
-		conf.afc_ki = req.i ? req.i : conf.afc_ki;
+		cli();
+		staged.afc_enable = !!req.state;
+		staged.afc_range = req.range ? req.range : staged.afc_range;
+		staged.afc_kp = req.p ? req.p : staged.afc_kp;
+		staged.afc_ki = req.i ? req.i : staged.afc_ki;
 		conf_set_reconf();
+		sei();
 	} else if (direction == ENDPOINT_DIR_IN) {
-		req.state = conf.afc_enable;
-		req.range = conf.afc_range;
-		req.p = conf.afc_kp;
-		req.i = conf.afc_ki;
+		req.state = staged.afc_enable;
+		req.range = staged.afc_range;
+		req.p = staged.afc_kp;
+		req.i = staged.afc_ki;
 		Endpoint_Write_Control_Stream_LE(&req, sizeof(req));
 	}
 }
@@ -214,6 +523,11 @@ static void do_training(int direction, unsigned int vWalue)
 	rf_config_single(uint16_t, training_ms);
 }
 
+static void do_training_inter(int direction, unsigned int vWalue)
+{
+	rf_config_single(uint16_t, training_inter_ms);
+}
+
 static void do_syncword(int direction, unsigned int vWalue)
 {
 	rf_config_single(uint32_t, sw);
@@ -224,14 +538,172 @@ static void do_bitrate(int direction, unsigned int vWalue)
 	rf_config_single(uint16_t, bitrate);
 }
 
+/* Occupied bandwidth is bitrate * (modindex + 1) and has to fit the
+ * 25 kHz IF filter. A faster preset needs a lower index, and has to be
+ * shown to run without byte loss before it is added */
+static const struct rate_preset rate_presets[RATE_PRESETS] PROGMEM = {
+	{ .bitrate = 2400,  .modindex = 8, .if_bw = 2 },
+};
+
+/* Apply the preset for the bitrate in wValue, or read the preset table.
+ * Unknown bitrates leave the configuration unchanged */
+static void do_rate_preset(int direction, unsigned int wValue)
+{
+	struct rate_preset presets[RATE_PRESETS];
+	uint8_t i;
+
+	memcpy_P(presets, rate_presets, sizeof(presets));
+
+	if (direction == ENDPOINT_DIR_OUT) {
+		for (i = 0; i < RATE_PRESETS; i++) {
+			if (presets[i].bitrate != wValue)
+				continue;
+			cli();
+			staged.bitrate = presets[i].bitrate;
+			staged.modindex = presets[i].modindex;
+			staged.if_bw = presets[i].if_bw;
+			conf_set_reconf();
+			sei();
+			break;
+		}
+	} else if (direction == ENDPOINT_DIR_IN) {
+		Endpoint_Write_Control_Stream_LE(presets, sizeof(presets));
+	}
+}
+
 static void do_tx(int direction, unsigned int vWalue)
 {
-	rf_config_single(uint32_t, tx);
+	rf_counter_single(uint32_t, tx);
+}
+
+struct timestamp_request {
+	uint32_t now;
+	uint32_t tx_timestamp;
+	uint32_t tx;
+} __attribute__ ((packed));
+
+static void do_timestamp(int direction, unsigned int vWalue)
+{
+	struct timestamp_request req;
+
+	if (direction == ENDPOINT_DIR_IN) {
+		cli();
+		req.now = timer_us();
+		req.tx_timestamp = conf.tx_timestamp;
+		req.tx = conf.tx;
+		sei();
+		Endpoint_Write_Control_Stream_LE(&req, sizeof(req));
+	}
+}
+
+struct queue_status {
+	uint8_t tx_free;
+	uint8_t tx_size;
+	uint8_t rx_pending;
+	uint8_t rx_size;
+	uint8_t state;
+	uint32_t tx_dropped;
+} __attribute__ ((packed));
+
+static void do_queue_status(int direction, unsigned int vWalue)
+{
+	struct queue_status status;
+
+	if (direction == ENDPOINT_DIR_IN) {
+		status.tx_free = spi_tx_free();
+		status.tx_size = TX_QUEUE_SIZE;
+		status.rx_pending = spi_rx_pending();
+		status.rx_size = RX_RING_SIZE;
+		status.state = 0;
+		if (spi_receiving())
+			status.state |= QUEUE_STATE_RECEIVING;
+		if (!csma_channel_clear())
+			status.state |= QUEUE_STATE_CSMA;
+		status.tx_dropped = stats.tx_oversize;
+		Endpoint_Write_Control_Stream_LE(&status, sizeof(status));
+	}
 }
 
 static void do_rx(int direction, unsigned int vWalue)
 {
-	rf_config_single(uint32_t, rx);
+	rf_counter_single(uint32_t, rx);
+}
+
+static void do_rx_overflow(int direction, unsigned int vWalue)
+{
+	uint32_t rx_overflow;
+
+	if (direction == ENDPOINT_DIR_OUT) {
+		Endpoint_Read_Control_Stream_LE(&rx_overflow, sizeof(rx_overflow));
+		cli();
+		stats.rx_overflow = rx_overflow;
+		sei();
+	} else if (direction == ENDPOINT_DIR_IN) {
+		cli();
+		rx_overflow = stats.rx_overflow;
+		sei();
+		Endpoint_Write_Control_Stream_LE(&rx_overflow, sizeof(rx_overflow));
+	}
+}
+
+/* Read the statistics block, or clear it on write */
+static void do_stats(int direction, unsigned int vWalue)
+{
+	if (direction == ENDPOINT_DIR_OUT) {
+		cli();
+		memset(&stats, 0, sizeof(stats));
+		sei();
+	} else if (direction == ENDPOINT_DIR_IN) {
+		cli();
+		ctrl_buf.stats = stats;
+		sei();
+		Endpoint_Write_Control_Stream_LE(&ctrl_buf.stats, sizeof(ctrl_buf.stats));
+	}
+}
+
+#if defined(BLUEBOX_PROFILE)
+/* Read the ISR and main loop profile, or restart it on write */
+static void do_profile(int direction, unsigned int vWalue)
+{
+	struct profile_request *req = &ctrl_buf.profile;
+
+	if (direction == ENDPOINT_DIR_OUT) {
+		profile_reset();
+	} else if (direction == ENDPOINT_DIR_IN) {
+		profile_get_report(req->slots);
+		req->stack_free = profile_stack_free();
+		Endpoint_Write_Control_Stream_LE(req, sizeof(*req));
+	}
+}
+#endif
+
+/* Enter raw mode with a nonzero wValue, leave it with zero */
+static void do_raw(int direction, unsigned int wValue)
+{
+	uint8_t raw;
+
+	if (direction == ENDPOINT_DIR_OUT) {
+		if (wValue)
+			spi_raw_start();
+		else
+			spi_raw_stop();
+	} else if (direction == ENDPOINT_DIR_IN) {
+		raw = spi_raw();
+		Endpoint_Write_Control_Stream_LE(&raw, sizeof(raw));
+	}
+}
+
+/* Read the idle time and event latency, or restart them on write */
+static void do_sched(int direction, unsigned int vWalue)
+{
+	struct sched_report report;
+
+	if (direction == ENDPOINT_DIR_OUT) {
+		sched_reset();
+	} else if (direction == ENDPOINT_DIR_IN) {
+		sched_get_report(&report);
+		Endpoint_Write_Control_Stream_LE(&report, sizeof(report));
+	}
 }
 
 static void do_fw_revision(int direction, unsigned int vWalue)
@@ -289,12 +761,24 @@ static void do_control_request(int direction)
 	case REQUEST_TRAINING:	
 		do_training(direction, USB_ControlRequest.wValue);
 		break;
+	case REQUEST_TRAINING_INTER:
+		do_training_inter(direction, USB_ControlRequest.wValue);
+		break;
 	case REQUEST_SYNCWORD:	
 		do_syncword(direction, USB_ControlRequest.wValue);
 		break;
 	case REQUEST_BITRATE:
 		do_bitrate(direction, USB_ControlRequest.wValue);
 		break;
+	case REQUEST_RATE_PRESET:
+		do_rate_preset(direction, USB_ControlRequest.wValue);
+		break;
+	case REQUEST_RAW:
+		do_raw(direction, USB_ControlRequest.wValue);
+		break;
+	case REQUEST_SCHED:
+		do_sched(direction, USB_ControlRequest.wValue);
+		break;
 	case REQUEST_TX:
 		do_tx(direction, USB_ControlRequest.wValue);
 		break;
@@ -307,6 +791,44 @@ static void do_control_request(int direction)
 	case REQUEST_RX_FREQUENCY:
 		do_rx_frequency(direction, USB_ControlRequest.wValue);
 		break;
+	case REQUEST_RX_OVERFLOW:
+		do_rx_overflow(direction, USB_ControlRequest.wValue);
+		break;
+	case REQUEST_CSMA_STATS:
+		do_csma_stats(direction, USB_ControlRequest.wValue);
+		break;
+	case REQUEST_CSMA_PARAMS:
+		do_csma_params(direction, USB_ControlRequest.wValue);
+		break;
+	case REQUEST_TIMESTAMP:
+		do_timestamp(direction, USB_ControlRequest.wValue);
+		break;
+	case REQUEST_QUEUE_STATUS:
+		do_queue_status(direction, USB_ControlRequest.wValue);
+		break;
+	case REQUEST_REG_BENCHMARK:
+		do_reg_benchmark(direction, USB_ControlRequest.wValue);
+		break;
+	case REQUEST_DOPPLER_TABLE:
+		do_doppler_table(direction, USB_ControlRequest.wValue);
+		break;
+	case REQUEST_DOPPLER_CTRL:
+		do_doppler_ctrl(direction, USB_ControlRequest.wValue);
+		break;
+	case REQUEST_CONFIG:
+		do_config(direction, USB_ControlRequest.wValue);
+		break;
+	case REQUEST_CONFIG_SEQ:
+		do_config_seq(direction, USB_ControlRequest.wValue);
+		break;
+	case REQUEST_STATS:
+		do_stats(direction, USB_ControlRequest.wValue);
+		break;
+#if defined(BLUEBOX_PROFILE)
+	case REQUEST_PROFILE:
+		do_profile(direction, USB_ControlRequest.wValue);
+		break;
+#endif
 	case REQUEST_SERIALNUMBER:
 		do_serialnumber(direction, USB_ControlRequest.wValue);
 		break;
@@ -322,60 +844,200 @@ static void do_control_request(int direction)
 	}
 }
 
-static bool csma_tx_allowed(void)
-{
-	int rssi;
-	static unsigned int quarantine = 0;
-
-	if (quarantine > 0) {
-		quarantine--;
-		delay_ms(1);
-	}
+/* Frame being read from the OUT endpoint. Each transfer is resumed when
+ * the next packet has arrived, so a slow host never blocks the main
+ * loop. The frame is queued once the header is in, and the transfer is
+ * abandoned if no packet arrives for TX_FILL_TIMEOUT_MS. The rest of an
+ * abandoned transfer is discarded up to the short packet or ZLP that
+ * ends it, so it is not taken for the header of the next one. */
+#define OUT_STAGE_IDLE		0
+#define OUT_STAGE_HEADER	1
+#define OUT_STAGE_DATA		2
+#define OUT_STAGE_PADDING	3
+#define OUT_STAGE_DISCARD	4
 
-	rssi = adf_readback_rssi();
+static struct {
+	uint8_t stage;
+	uint32_t last_ms;
+	uint16_t done;
+	uint16_t padding;
+	struct tx_header hdr;
+	struct tx_buffer *buf;
+} out_xfer;
 
-	if (rssi > conf.csma_rssi)
-		quarantine = 100;
+/* Release the reserved slot, or let the ISR skip a queued frame */
+static void out_xfer_abort(void)
+{
+	if (out_xfer.stage == OUT_STAGE_HEADER)
+		spi_tx_cancel();
+	else if (out_xfer.stage == OUT_STAGE_DATA)
+		spi_tx_filled(out_xfer.buf, false);
+	out_xfer.stage = OUT_STAGE_IDLE;
+}
 
-	return (rssi <= conf.csma_rssi);
+/* Bytes of the transfer read so far, when no packet is pending */
+static uint16_t out_xfer_offset(void)
+{
+	if (out_xfer.stage == OUT_STAGE_HEADER)
+		return out_xfer.done;
+	if (out_xfer.stage == OUT_STAGE_DATA)
+		return sizeof(out_xfer.hdr) + out_xfer.done;
+	return TOTAL_LENGTH - out_xfer.padding + out_xfer.done;
 }
 
 static void tx_task(void)
 {
-	if (USB_DeviceState != DEVICE_STATE_Configured)
+	static bool held_off = false;
+	uint8_t err;
+	bool ended;
+
+	if (USB_DeviceState != DEVICE_STATE_Configured) {
+		/* Abandon the transfer, the host starts over */
+		out_xfer_abort();
 		return;
+	}
 
 	Endpoint_SelectEndpoint(OUT_EPADDR);
-	if (Endpoint_IsOUTReceived() && csma_tx_allowed() && spi_tx_prepare()) {
-		if (Endpoint_IsReadWriteAllowed()) {
-			if (!(data[front].flags & FLAG_TX_READY)) {
-				Endpoint_Read_Stream_LE(&data[front], sizeof(data[front]), NULL);
-				data[front].flags |= FLAG_TX_READY;
-				adf_set_tx_mode();
-				spi_tx_start();
-			} else {
-				Endpoint_Read_Stream_LE(&data[back], sizeof(data[back]), NULL);
-				data[back].flags |= FLAG_TX_READY;
+
+	/* The host stopped sending, do not stay keyed waiting for it. Unless
+	 * the last packet was short, more of the transfer is still to come */
+	if (out_xfer.stage != OUT_STAGE_IDLE && out_xfer.stage != OUT_STAGE_DISCARD &&
+	    !Endpoint_IsOUTReceived() && timer_ms() - out_xfer.last_ms > TX_FILL_TIMEOUT_MS) {
+		stats.tx_fill_timeout++;
+		ended = out_xfer_offset() % data_out_epsize() != 0;
+		out_xfer_abort();
+		if (!ended)
+			out_xfer.stage = OUT_STAGE_DISCARD;
+		return;
+	}
+
+	if (out_xfer.stage == OUT_STAGE_IDLE) {
+		if (!Endpoint_IsOUTReceived() || !Endpoint_IsReadWriteAllowed() ||
+		    !csma_tx_allowed())
+			return;
+
+		/* Count each time a full queue holds the host off, not every
+		 * poll. A frame being received or raw mode also refuse TX */
+		if (!(out_xfer.buf = spi_tx_prepare())) {
+			if (!spi_tx_free()) {
+				if (!held_off)
+					stats.tx_queue_full++;
+				held_off = true;
+			}
+			return;
+		}
+		held_off = false;
+
+		out_xfer.stage = OUT_STAGE_HEADER;
+		out_xfer.done = 0;
+	}
+
+	while (Endpoint_IsOUTReceived()) {
+		out_xfer.last_ms = timer_ms();
+
+		switch (out_xfer.stage) {
+		case OUT_STAGE_HEADER:
+			err = Endpoint_Read_Stream_LE(&out_xfer.hdr, sizeof(out_xfer.hdr), &out_xfer.done);
+			if (err == ENDPOINT_RWSTREAM_IncompleteTransfer)
+				continue;
+			if (err != ENDPOINT_RWSTREAM_NoError) {
+				stats.tx_usb_errors++;
+				spi_tx_cancel();
+				goto done;
+			}
+
+			out_xfer.done = 0;
+			out_xfer.padding = TOTAL_LENGTH - sizeof(out_xfer.hdr);
+
+			/* Only the frame itself is kept, the padding is dropped */
+			if (out_xfer.hdr.size > DATA_LENGTH) {
+				stats.tx_oversize++;
+				spi_tx_cancel();
+				out_xfer.stage = OUT_STAGE_PADDING;
+				break;
 			}
+
+			/* Key up now, the data arrives during the PTT delay
+			 * and the training sequence */
+			out_xfer.buf->size = out_xfer.hdr.size;
+			out_xfer.buf->state = TX_BUFFER_FILLING;
+			spi_tx_queue(out_xfer.buf);
+			out_xfer.padding -= out_xfer.hdr.size;
+			out_xfer.stage = OUT_STAGE_DATA;
+			break;
+		case OUT_STAGE_DATA:
+			spi_tx_progress(out_xfer.buf);
+			err = Endpoint_Read_Stream_LE(out_xfer.buf->data, out_xfer.hdr.size, &out_xfer.done);
+			if (err == ENDPOINT_RWSTREAM_IncompleteTransfer)
+				continue;
+			spi_tx_filled(out_xfer.buf, err == ENDPOINT_RWSTREAM_NoError);
+			if (err != ENDPOINT_RWSTREAM_NoError) {
+				stats.tx_usb_errors++;
+				goto done;
+			}
+
+			out_xfer.done = 0;
+			out_xfer.stage = OUT_STAGE_PADDING;
+			break;
+		case OUT_STAGE_PADDING:
+			err = Endpoint_Discard_Stream(out_xfer.padding, &out_xfer.done);
+			if (err == ENDPOINT_RWSTREAM_IncompleteTransfer)
+				continue;
+			if (err != ENDPOINT_RWSTREAM_NoError)
+				stats.tx_usb_errors++;
+			goto done;
+		case OUT_STAGE_DISCARD:
+			if (Endpoint_BytesInEndpoint() < data_out_epsize())
+				goto done;
 			Endpoint_ClearOUT();
+			break;
 		}
 	}
+
+	return;
+
+done:
+	Endpoint_ClearOUT();
+	out_xfer.stage = OUT_STAGE_IDLE;
 }
 
 static void conf_task(void)
 {
+	uint16_t start;
+
+	/* Control requests set the flag from the USB interrupt. A stale
+	 * read here only delays the work to the next event, the flag is
+	 * checked again with interrupts disabled */
+	if (!conf_should_reconf())
+		return;
+
 	cli();
 
-	if (!spi_busy() && conf_should_reconf()) {
+	/* Idle gap between frames, swap in the staged image. A TX burst
+	 * is paused at the next frame end to make the gap */
+	if (spi_reconf_allowed() && conf_should_reconf()) {
+		config_copy_all(&conf, &staged);
+		active_seq = staged_seq;
+
+		/* Wraps if it ever takes more than 65535 Timer1 counts */
+		start = timer_ticks();
 		adf_configure();
+		configure_cycles = (uint32_t)(uint16_t)(timer_ticks() - start) * TIMER_TICK_CYCLES;
+		doppler_resync();
 		conf_clear_reconf();
+		spi_reconfigured();
 	}
 
 	sei();
 }
 
+/* Runs from the USB_COM interrupt with interrupts enabled again, so it
+ * may preempt the main loop but not the other ISRs. State shared with
+ * the main loop or the ISRs is only changed with interrupts disabled */
 void EVENT_USB_Device_ControlRequest(void)
 {
+	profile_enter();
+
 	switch (USB_ControlRequest.bmRequestType) {
 	case (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE):
 		Endpoint_ClearSETUP();
@@ -390,14 +1052,19 @@ void EVENT_USB_Device_ControlRequest(void)
 	default:
 		break;
 	}
+
+	profile_exit(PROFILE_CONTROL);
 }
 
 int main(void)
 {
+	uint8_t events;
+
 	setup_hardware();
 	GlobalInterruptEnable();
 
 	callsign_init(conf.callsign);
+	config_copy_all(&staged, &conf);
 
 	led_off(LED_ALL);
 
@@ -410,10 +1077,34 @@ int main(void)
 
 	led_on(LED_POWER);
 
+	csma_init();
+	sched_init();
+#if defined(BLUEBOX_PROFILE)
+	profile_reset();
+#endif
+
+	/* Polled tasks run on the system tick. Frames and configuration
+	 * changes are picked up as soon as they are posted, and a frame
+	 * end gives a staged configuration the chance to take effect.
+	 * Control requests are handled from the USB interrupt */
 	while (1) {
-		conf_task();
-		rx_task();
-		tx_task();
-		USB_USBTask();
+		events = sched_wait();
+		profile_enter();
+
+		if (events & EVENT_TICK) {
+			csma_task();
+			doppler_task();
+		}
+
+		if (events & (EVENT_TICK | EVENT_CONF | EVENT_RX))
+			conf_task();
+
+		if (events & (EVENT_TICK | EVENT_RX))
+			rx_task();
+
+		if (events & EVENT_TICK)
+			tx_task();
+
+		profile_exit(PROFILE_LOOP);
 	}
 }
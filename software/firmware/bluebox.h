@@ -56,6 +56,22 @@
 #define REQUEST_RX		0x0D
 #define REQUEST_TX_FREQUENCY	0x0E
 #define REQUEST_RX_FREQUENCY	0x0F
+#define REQUEST_RX_OVERFLOW	0x10
+#define REQUEST_CSMA_STATS	0x11
+#define REQUEST_CSMA_PARAMS	0x12
+#define REQUEST_TIMESTAMP	0x13
+#define REQUEST_TRAINING_INTER	0x14
+#define REQUEST_QUEUE_STATUS	0x15
+#define REQUEST_REG_BENCHMARK	0x16
+#define REQUEST_DOPPLER_TABLE	0x17
+#define REQUEST_DOPPLER_CTRL	0x18
+#define REQUEST_CONFIG		0x19
+#define REQUEST_STATS		0x1A
+#define REQUEST_PROFILE		0x1B
+#define REQUEST_RATE_PRESET	0x1C
+#define REQUEST_RAW		0x1D
+#define REQUEST_SCHED		0x1E
+#define REQUEST_CONFIG_SEQ	0x1F
 #define REQUEST_SERIALNUMBER	0xFC
 #define REQUEST_FWREVISION	0xFD
 #define REQUEST_RESET		0xFE
@@ -70,6 +86,11 @@
 #define TX_TIMEOUT_DELAY	10U
 #define RX_WAIT_TIMEOUT		120U
 #define CSMA_RSSI		-50
+#define CSMA_HYSTERESIS		3
+#define CSMA_PERSISTENCE	255
+#define CSMA_SLOT_MS		20
+#define CSMA_BE_MIN		2
+#define CSMA_BE_MAX		5
 #define BAUD_RATE		2400
 #define MOD_INDEX		8
 #define PA_SETTING		8
@@ -104,25 +125,148 @@
 #define CSP_OVERHEAD		6
 #define BITS_PER_BYTE		8
 
-/* Buffer configuration */
+/* Buffer configuration. TOTAL_LENGTH is the size of a TX transfer from
+ * the host, DATA_LENGTH the longest frame on air (long frame with RS and
+ * viterbi coding) */
 #define TOTAL_LENGTH		300
-#define DATA_LENGTH		(TOTAL_LENGTH - sizeof(uint16_t) * 5 - sizeof(uint8_t) * 1)
-#define NUM_BUFS		2
+#define DATA_LENGTH		((CSP_OVERHEAD + LONG_FRAME_LIMIT + RS_LENGTH + VITERBI_TAIL) * VITERBI_RATE)
 
-/* This must be 300 bytes */
+/* Number of frame buffers in the RX ring and the TX queue, must be
+ * power of 2 and max 128! Each frame takes about 260 bytes of SRAM, so
+ * the standard board has two of each. The micro only has room for two
+ * frames in all, so like the old ping-pong buffers a TX frame borrows a
+ * free RX slot */
+#ifndef RX_RING_SIZE
+#define RX_RING_SIZE		2
+#endif
+
+#ifndef TX_QUEUE_SIZE
+#if defined(BBMICRO)
+#define TX_QUEUE_SIZE		1
+#define TX_SHARES_RX_RING
+#else
+#define TX_QUEUE_SIZE		2
+#endif
+#endif
+
+#define RX_RING_MASK		(RX_RING_SIZE - 1)
+#define TX_QUEUE_MASK		(TX_QUEUE_SIZE - 1)
+
+#if (RX_RING_SIZE & RX_RING_MASK)
+#error RX ring size is not a power of 2
+#endif
+
+#if (TX_QUEUE_SIZE & TX_QUEUE_MASK)
+#error TX queue size is not a power of 2
+#endif
+
+#if defined(TX_SHARES_RX_RING) && (TX_QUEUE_SIZE != 1)
+#error A TX queue in the RX ring only has one slot
+#endif
+
+/* Size of the raw mode byte ring, must be power of 2! It shares memory
+ * with the RX ring, so it should not be larger */
+#ifndef RAW_RING_SIZE
+#if defined(BBMICRO)
+#define RAW_RING_SIZE		256
+#else
+#define RAW_RING_SIZE		512
+#endif
+#endif
+
+#define RAW_RING_MASK		(RAW_RING_SIZE - 1)
+
+#if (RAW_RING_SIZE & RAW_RING_MASK)
+#error Raw ring size is not a power of 2
+#endif
+
+/* Raw chunks are sent once RAW_CHUNK_MIN bytes are waiting or
+ * RAW_FLUSH_MS after the previous chunk, and hold at most RAW_CHUNK_MAX */
+#define RAW_CHUNK_MIN		64
+#define RAW_CHUNK_MAX		256
+#define RAW_FLUSH_MS		20
+
+/* Received frame */
 struct data_buffer {
 	volatile uint16_t size;
 	volatile uint16_t progress;
 	volatile int16_t rssi;
 	volatile int16_t freq;
 	volatile uint8_t flags;
-	volatile uint16_t training;
+	volatile uint8_t fsm_distance;
+	volatile uint16_t seq;
+	volatile uint32_t timestamp;
+	uint8_t data[DATA_LENGTH];
+};
+
+/* Frame waiting to be sent. It is queued once the header has arrived
+ * and state tells the ISR when the data is complete */
+struct tx_buffer {
+	uint16_t size;
+	volatile uint8_t state;
 	uint8_t data[DATA_LENGTH];
 };
 
+#define TX_BUFFER_FILLING	0
+#define TX_BUFFER_READY		1
+#define TX_BUFFER_FAILED	2
+
+/* Each packet of a queued frame has to arrive within this time of the
+ * previous one, as it did for the blocking stream reads. The ISR keeps
+ * stretching the training sequence for twice as long, so tx_task() is
+ * always the one to abandon the transfer */
+#define TX_FILL_TIMEOUT_MS	USB_STREAM_TIMEOUT_MS
+#define TX_STRETCH_MS		(2 * TX_FILL_TIMEOUT_MS)
+
+/* Header of a frame sent on the OUT endpoint. Every transfer is
+ * TOTAL_LENGTH bytes, the header followed by size bytes of frame data
+ * and padding. Only size is used by the firmware */
+struct tx_header {
+	uint16_t size;
+	uint16_t progress;
+	int16_t rssi;
+	int16_t freq;
+	uint8_t flags;
+	uint16_t training;
+} __attribute__ ((packed));
+
+/* Header sent on the IN endpoint in front of each received frame. It is
+ * followed by size bytes of frame data, and the transfer is always
+ * terminated by a short (possibly zero length) packet. The timestamp is
+ * the time of sync word detection in microseconds, see timer_us(). rssi
+ * and freq are zero with FLAG_NO_READBACK set */
+struct rx_header {
+	uint16_t size;
+	int16_t rssi;
+	int16_t freq;
+	uint8_t flags;
+	uint16_t seq;
+	uint32_t timestamp;
+} __attribute__ ((packed));
+
+/* Header sent on the IN endpoint in front of each chunk in raw mode.
+ * offset is the position of the first byte in the demodulated stream,
+ * counting bytes that were dropped. RAW_FLAG_GAP is set on the first
+ * chunk after a drop, RAW_FLAG_RECONF on the first chunk received with
+ * a new configuration */
+struct raw_header {
+	uint16_t size;
+	uint8_t flags;
+	uint16_t seq;
+	uint32_t offset;
+} __attribute__ ((packed));
+
+#define RAW_FLAG_GAP		0x01
+#define RAW_FLAG_RECONF		0x02
+
 /* Data buffer flags */
 #define FLAG_RX_READY		0x01
-#define FLAG_TX_READY		0x02
+#define FLAG_LONG_FRAME		0x02
+#define FLAG_NO_READBACK	0x04	/* RSSI and AFC not read while on air */
+
+/* Queue status state bits */
+#define QUEUE_STATE_RECEIVING	0x01
+#define QUEUE_STATE_CSMA	0x02
 
 /* Config flags */
 #define CONF_FLAG_NONE		0x00
@@ -133,6 +277,11 @@ struct bluebox_config {
 	uint32_t tx_freq;
 	uint32_t rx_freq;
 	int16_t csma_rssi;
+	uint8_t csma_hyst;
+	uint8_t csma_persist;
+	uint8_t csma_slot_ms;
+	uint8_t csma_be_min;
+	uint8_t csma_be_max;
 	uint16_t bitrate;
 	uint8_t modindex;
 	uint8_t pa_setting;
@@ -151,12 +300,74 @@ struct bluebox_config {
 	uint16_t training_inter_ms;
 	char callsign[CALLSIGN_LENGTH];
 	uint32_t tx;
+	volatile uint32_t tx_timestamp;
 	uint32_t rx;
+	uint32_t csma_deferrals;
+	volatile uint32_t csma_busy_ms;
 	uint16_t ptt_delay_high;
 	uint16_t ptt_delay_low;
 	char *fw_revision;
 };
 
+/* Configuration image used by REQUEST_CONFIG. The layout of a version
+ * must never change, new fields go into a new version */
+#define CONFIG_VERSION		1
+
+#define CONFIG_STATUS_OK	0
+#define CONFIG_STATUS_VERSION	1
+#define CONFIG_STATUS_LENGTH	2
+#define CONFIG_STATUS_VALUE	3
+
+/* Valid ranges */
+#define CONFIG_FREQ_MIN		80000000UL
+#define CONFIG_FREQ_MAX		960000000UL
+#define CONFIG_BITRATE_MIN	200
+#define CONFIG_BITRATE_MAX	32768
+#define CONFIG_PA_MAX		63
+#define CONFIG_IF_BW_MAX	2
+
+/* Data rate presets. Only rates shown to run without byte loss are
+ * listed, which so far is the default 2400 bps */
+#define RATE_PRESETS		1
+
+struct rate_preset {
+	uint16_t bitrate;
+	uint8_t modindex;
+	uint8_t if_bw;
+} __attribute__ ((packed));
+
+struct config_image {
+	uint8_t version;
+	uint8_t status;
+	uint32_t tx_freq;
+	uint32_t rx_freq;
+	int16_t csma_rssi;
+	uint8_t csma_hyst;
+	uint8_t csma_persist;
+	uint8_t csma_slot_ms;
+	uint8_t csma_be_min;
+	uint8_t csma_be_max;
+	uint16_t bitrate;
+	uint8_t modindex;
+	uint8_t pa_setting;
+	uint8_t afc_range;
+	uint8_t afc_ki;
+	uint8_t afc_kp;
+	uint8_t afc_enable;
+	uint8_t if_bw;
+	uint32_t sw;
+	uint8_t swtol;
+	uint8_t swlen;
+	uint8_t do_rs;
+	uint8_t do_viterbi;
+	uint8_t training_symbol;
+	uint16_t training_ms;
+	uint16_t training_inter_ms;
+	char callsign[CALLSIGN_LENGTH];
+	uint16_t ptt_delay_high;
+	uint16_t ptt_delay_low;
+} __attribute__ ((packed));
+
 extern struct bluebox_config conf;
 extern uint32_t serialno __attribute__((section(".eeprom")));
 
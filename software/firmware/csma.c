@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "bluebox.h"
+#include "adf7021.h"
+#include "csma.h"
+
+/* Lowest RSSI reported by the ADF7021 */
+#define CSMA_RSSI_FLOOR		-130
+
+/* The timer tick paces the RSSI samples and counts down the backoff,
+ * while the samples themselves are read from the main loop so the
+ * register interface is never used from two contexts at once. The
+ * channel is considered busy when the window average rises above
+ * conf.csma_rssi, and idle again when it falls conf.csma_hyst dB below
+ * it. */
+static int16_t window[CSMA_WINDOW];
+static int16_t window_sum;
+static uint8_t window_pos;
+
+static volatile bool busy = false;
+static volatile bool sample_due = false;
+static volatile uint8_t sample_div = CSMA_SAMPLE_MS;
+static volatile uint16_t backoff = 0;
+static uint8_t backoff_exp;
+static uint16_t seed = 1;
+
+void csma_init(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < CSMA_WINDOW; i++)
+		window[i] = CSMA_RSSI_FLOOR;
+	window_sum = CSMA_RSSI_FLOOR * CSMA_WINDOW;
+	window_pos = 0;
+
+	busy = false;
+	backoff = 0;
+	backoff_exp = conf.csma_be_min;
+}
+
+static uint16_t csma_random(void)
+{
+	/* 16 bit xorshift, reseeded with RSSI noise in csma_task() */
+	seed ^= seed << 7;
+	seed ^= seed >> 9;
+	seed ^= seed << 8;
+
+	return seed;
+}
+
+static void csma_defer(uint16_t slots)
+{
+	uint16_t ticks = slots * conf.csma_slot_ms;
+
+	conf.csma_deferrals++;
+
+	cli();
+	backoff = ticks;
+	sei();
+}
+
+void csma_task(void)
+{
+	adf_reg_t readback;
+	int16_t rssi, avg, threshold;
+	uint8_t hyst;
+
+	if (!sample_due)
+		return;
+	sample_due = false;
+
+	/* Our own transmissions say nothing about the channel */
+	if (!adf_in_rx_mode())
+		return;
+
+	/* The thresholds are set from the USB interrupt */
+	cli();
+	readback = adf_read_reg(ADF_READBACK_RSSI);
+	threshold = conf.csma_rssi;
+	hyst = conf.csma_hyst;
+	sei();
+
+	rssi = adf_convert_rssi(readback);
+	seed ^= readback.word.lower;
+	if (!seed)
+		seed = 1;
+
+	window_sum += rssi - window[window_pos];
+	window[window_pos] = rssi;
+	window_pos = (window_pos + 1) & CSMA_WINDOW_MASK;
+
+	avg = window_sum / CSMA_WINDOW;
+	if (busy)
+		busy = (avg > threshold - hyst);
+	else
+		busy = (avg > threshold);
+}
+
+void csma_tick(void)
+{
+	if (!--sample_div) {
+		sample_div = CSMA_SAMPLE_MS;
+		sample_due = true;
+	}
+
+	/* Backoff is frozen while the channel is busy */
+	if (busy)
+		conf.csma_busy_ms++;
+	else if (backoff)
+		backoff--;
+}
+
+static bool csma_backing_off(void)
+{
+	bool ret;
+
+	cli();
+	ret = (backoff != 0);
+	sei();
+
+	return ret;
+}
+
+bool csma_tx_allowed(void)
+{
+	uint16_t slots;
+	uint8_t be_max;
+
+	if (csma_backing_off())
+		return false;
+
+	/* Busy: back off a random number of slots, doubling the
+	 * range every time up to 2^csma_be_max slots */
+	if (busy) {
+		be_max = conf.csma_be_max < CSMA_BE_LIMIT ? conf.csma_be_max : CSMA_BE_LIMIT;
+		if (backoff_exp > be_max)
+			backoff_exp = be_max;
+		slots = (csma_random() & ((1U << backoff_exp) - 1)) + 1;
+		if (backoff_exp < be_max)
+			backoff_exp++;
+		csma_defer(slots);
+		return false;
+	}
+
+	/* Idle: transmit with probability (csma_persist + 1) / 256,
+	 * otherwise wait one slot and try again */
+	if ((csma_random() & 0xff) > conf.csma_persist) {
+		csma_defer(1);
+		return false;
+	}
+
+	backoff_exp = conf.csma_be_min;
+
+	return true;
+}
+
+bool csma_channel_busy(void)
+{
+	return busy;
+}
+
+/* True if a frame would be sent now, ignoring persistence */
+bool csma_channel_clear(void)
+{
+	return !busy && !csma_backing_off();
+}
+
+int16_t csma_rssi_average(void)
+{
+	return window_sum / CSMA_WINDOW;
+}
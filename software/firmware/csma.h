@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _CSMA_H_
+#define _CSMA_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Milliseconds between RSSI samples */
+#ifndef CSMA_SAMPLE_MS
+#define CSMA_SAMPLE_MS		2
+#endif
+
+/* Number of samples in the RSSI window, must be power of 2 and max 128! */
+#ifndef CSMA_WINDOW
+#if defined(BBMICRO)
+#define CSMA_WINDOW		4
+#else
+#define CSMA_WINDOW		8
+#endif
+#endif
+
+#define CSMA_WINDOW_MASK	(CSMA_WINDOW - 1)
+
+#if (CSMA_WINDOW & CSMA_WINDOW_MASK)
+#error CSMA window size is not a power of 2
+#endif
+
+/* Largest backoff exponent, keeps the backoff within 16 bits of ticks */
+#define CSMA_BE_LIMIT		8
+
+void csma_init(void);
+void csma_task(void);
+void csma_tick(void);
+bool csma_tx_allowed(void);
+bool csma_channel_busy(void);
+bool csma_channel_clear(void);
+int16_t csma_rssi_average(void);
+
+#endif /* _CSMA_H_ */
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "bluebox.h"
+#include "adf7021.h"
+#include "spi.h"
+#include "timer.h"
+#include "doppler.h"
+
+/* The schedule is a ring of steps indexed by free running 16 bit
+ * indices. The host appends steps at the end or replaces pending ones,
+ * up to DOPPLER_STEPS ahead of the next step to be applied, so a pass
+ * longer than the table can be streamed while it runs. Steps are
+ * applied from the main loop when no frame is in progress, and only
+ * rewrite R0. */
+static struct doppler_step steps[DOPPLER_STEPS];
+static uint16_t next = 0;
+static uint16_t end = 0;
+
+static bool running = false;
+static bool dirty = false;
+static uint32_t start_ms;
+static int16_t rx_offset = 0;
+static int16_t tx_offset = 0;
+
+static inline struct doppler_step *doppler_slot(uint16_t index)
+{
+	return &steps[index & DOPPLER_STEPS_MASK];
+}
+
+bool doppler_load(uint16_t index, struct doppler_step *step)
+{
+	/* Steps must be appended in order or replace pending steps, and
+	 * the ones still pending must not be overwritten by the append */
+	if ((uint16_t)(index - next) > (uint16_t)(end - next))
+		return false;
+	if ((uint16_t)(index - next) >= DOPPLER_STEPS)
+		return false;
+
+	*doppler_slot(index) = *step;
+
+	if (index == end)
+		end++;
+
+	return true;
+}
+
+void doppler_start(void)
+{
+	start_ms = timer_ms();
+	running = true;
+}
+
+/* Stop and return to the configured frequencies. The schedule is
+ * cleared */
+void doppler_stop(void)
+{
+	running = false;
+	next = end = 0;
+	rx_offset = tx_offset = 0;
+	dirty = true;
+}
+
+/* Apply the current offsets again after a full reconfigure */
+void doppler_resync(void)
+{
+	if (rx_offset || tx_offset)
+		dirty = true;
+}
+
+void doppler_get_status(struct doppler_status *status)
+{
+	status->running = running;
+	status->next = next;
+	status->end = end;
+	status->elapsed_ms = running ? timer_ms() - start_ms : 0;
+	status->rx_offset = rx_offset;
+	status->tx_offset = tx_offset;
+}
+
+void doppler_task(void)
+{
+	uint32_t elapsed;
+	struct doppler_step *step;
+
+	/* Control requests change the schedule from interrupt context */
+	cli();
+
+	if (running) {
+		elapsed = timer_ms() - start_ms;
+
+		/* Skip to the latest step that is due */
+		while (next != end) {
+			step = doppler_slot(next);
+			if (elapsed < step->time_ms)
+				break;
+			rx_offset = step->rx_offset;
+			tx_offset = step->tx_offset;
+			next++;
+			dirty = true;
+		}
+	}
+
+	/* Wait for the frame in progress. A retune is short enough to
+	 * not lose raw mode bytes */
+	if (!dirty || (spi_busy() && !spi_raw())) {
+		sei();
+		return;
+	}
+
+	adf_set_frequency(conf.rx_freq + rx_offset, conf.tx_freq + tx_offset);
+	dirty = false;
+
+	sei();
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _DOPPLER_H_
+#define _DOPPLER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Number of entries in the schedule, must be power of 2 and max 32768! */
+#ifndef DOPPLER_STEPS
+#if defined(BBMICRO)
+#define DOPPLER_STEPS		4
+#else
+#define DOPPLER_STEPS		16
+#endif
+#endif
+
+#define DOPPLER_STEPS_MASK	(DOPPLER_STEPS - 1)
+
+#if (DOPPLER_STEPS & DOPPLER_STEPS_MASK)
+#error Doppler schedule size is not a power of 2
+#endif
+
+/* Most entries accepted by one table request, a longer one is stalled.
+ * They are read onto the stack, and never more than a full table is
+ * accepted anyway */
+#if (DOPPLER_STEPS < 8)
+#define DOPPLER_CHUNK		DOPPLER_STEPS
+#else
+#define DOPPLER_CHUNK		8
+#endif
+
+/* Frequency offsets in Hz from conf.rx_freq and conf.tx_freq, applied
+ * time_ms milliseconds after the schedule was started */
+struct doppler_step {
+	uint32_t time_ms;
+	int16_t rx_offset;
+	int16_t tx_offset;
+} __attribute__ ((packed));
+
+struct doppler_status {
+	uint8_t running;
+	uint16_t next;
+	uint16_t end;
+	uint32_t elapsed_ms;
+	int16_t rx_offset;
+	int16_t tx_offset;
+} __attribute__ ((packed));
+
+bool doppler_load(uint16_t index, struct doppler_step *step);
+void doppler_start(void);
+void doppler_stop(void);
+void doppler_resync(void);
+void doppler_get_status(struct doppler_status *status);
+void doppler_task(void);
+
+#endif /* _DOPPLER_H_ */
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <avr/interrupt.h>
+
+#include "profile.h"
+
+#if defined(BLUEBOX_PROFILE)
+
+struct profile_slot profile[PROFILE_SLOTS];
+
+/* Free RAM between .bss and the stack is painted before main() runs.
+ * The bytes the stack has never reached still hold the paint */
+#define PROFILE_STACK_PAINT	0xC5
+
+extern uint8_t _end;
+extern uint8_t __stack;
+
+void profile_stack_paint(void) __attribute__ ((naked, used, section (".init1")));
+void profile_stack_paint(void)
+{
+	__asm__ volatile (
+		"	ldi r30, lo8(_end)\n"
+		"	ldi r31, hi8(_end)\n"
+		"	ldi r24, %0\n"
+		"	ldi r25, hi8(__stack)\n"
+		"	rjmp 2f\n"
+		"1:	st Z+, r24\n"
+		"2:	cpi r30, lo8(__stack)\n"
+		"	cpc r31, r25\n"
+		"	brlo 1b\n"
+		:: "M" (PROFILE_STACK_PAINT));
+}
+
+/* Smallest number of bytes that were ever free below the stack */
+uint16_t profile_stack_free(void)
+{
+	const uint8_t *p = &_end;
+
+	while (p < &__stack && *p == PROFILE_STACK_PAINT)
+		p++;
+
+	return p - &_end;
+}
+
+void profile_reset(void)
+{
+	uint8_t i;
+
+	cli();
+	for (i = 0; i < PROFILE_SLOTS; i++) {
+		profile[i].min = UINT16_MAX;
+		profile[i].max = 0;
+		profile[i].sum = 0;
+		profile[i].count = 0;
+	}
+	sei();
+}
+
+/* Fill report with PROFILE_SLOTS entries */
+void profile_get_report(struct profile_report *report)
+{
+	uint8_t i;
+	struct profile_slot p;
+
+	for (i = 0; i < PROFILE_SLOTS; i++) {
+		cli();
+		p = profile[i];
+		sei();
+
+		if (p.count == 0) {
+			memset(&report[i], 0, sizeof(report[i]));
+			continue;
+		}
+
+		report[i].min = (uint32_t) p.min * TIMER_TICK_CYCLES;
+		report[i].avg = p.sum / p.count * TIMER_TICK_CYCLES;
+		report[i].max = (uint32_t) p.max * TIMER_TICK_CYCLES;
+		report[i].count = p.count;
+	}
+}
+
+#endif
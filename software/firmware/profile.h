@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "timer.h"
+
+/* Profiled code paths */
+#define PROFILE_RX		0	/* Received data byte */
+#define PROFILE_TX		1	/* Transmitted callsign, FSM or data byte */
+#define PROFILE_PREAMBLE	2	/* Transmitted training symbol */
+#define PROFILE_FRAME_END	3	/* Last byte of an RX or TX frame */
+#define PROFILE_SYNC		4	/* Sync word interrupt */
+#define PROFILE_LOOP		5	/* One main loop iteration */
+#define PROFILE_CONTROL		6	/* Vendor control request */
+#define PROFILE_SLOTS		7
+
+/* Durations are in CPU cycles with a resolution of TIMER_TICK_CYCLES.
+ * ISR prologue and epilogue are not included. Loop iterations longer
+ * than 65535 Timer1 counts wrap */
+struct profile_report {
+	uint32_t min;
+	uint32_t avg;
+	uint32_t max;
+	uint32_t count;
+} __attribute__ ((packed));
+
+/* Reply to REQUEST_PROFILE. stack_free is the low-water mark of the
+ * unused RAM since reset, it is not cleared by a restart */
+struct profile_request {
+	struct profile_report slots[PROFILE_SLOTS];
+	uint16_t stack_free;
+} __attribute__ ((packed));
+
+#if defined(BLUEBOX_PROFILE)
+
+struct profile_slot {
+	uint16_t min;
+	uint16_t max;
+	uint32_t sum;
+	uint32_t count;
+};
+
+extern struct profile_slot profile[PROFILE_SLOTS];
+
+/* Called from one context per slot only */
+static inline void profile_record(uint8_t slot, uint16_t ticks)
+{
+	struct profile_slot *p = &profile[slot];
+
+	if (ticks < p->min)
+		p->min = ticks;
+	if (ticks > p->max)
+		p->max = ticks;
+	p->sum += ticks;
+	p->count++;
+}
+
+/* The 16-bit TCNT1 read goes through the shared TEMP register, so it
+ * must not be interrupted by an ISR that reads it too */
+static inline uint16_t profile_ticks(void)
+{
+	uint8_t sreg = SREG;
+	uint16_t ticks;
+
+	cli();
+	ticks = timer_ticks();
+	SREG = sreg;
+
+	return ticks;
+}
+
+#define profile_enter()		uint16_t profile_start = profile_ticks()
+#define profile_exit(slot)	profile_record(slot, profile_ticks() - profile_start)
+
+void profile_reset(void);
+void profile_get_report(struct profile_report *report);
+uint16_t profile_stack_free(void);
+
+#else
+
+#define profile_enter()		do { } while (0)
+#define profile_exit(slot)	do { } while (0)
+
+#endif
+
+#endif /* _PROFILE_H_ */
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "bluebox.h"
+#include "ptt.h"
+
+/* The RX/TX turnaround is run from the timer tick so neither the main
+ * loop nor the SPI interrupt has to wait for the RF switches, LNA and
+ * PA to settle. The sequence always runs to completion before it is
+ * reversed, and the callback is called when the requested state has
+ * been reached. */
+enum ptt_state {
+	PTT_RX,
+	PTT_KEY_LNA,		/* External LNA off */
+	PTT_KEY_PA,		/* Switched to TX, on-board PA on */
+	PTT_KEY_EXT,		/* External PA on */
+	PTT_TX,
+	PTT_RELEASE_EXT,	/* External PA off */
+};
+
+static volatile uint8_t ptt_state = PTT_RX;
+static volatile bool ptt_want_tx = false;
+static volatile uint16_t ptt_wait = 0;
+static void (*volatile ptt_done)(void) = NULL;
+
+static void ptt_set_rx(void)
+{
+#if defined(PIN_EXT_PTT)
+	/* Power on external LNA */
+	PORT_RF_CONTROL |=  _BV(PIN_EXT_LNA);
+
+	/* Power off on-board PA */
+	PORT_PALNA_CONTROL &= ~_BV(PIN_PA_BIAS_EN);
+#endif
+
+	/* Switch on-board RX/TX switch to receive */
+	PORT_RF_CONTROL &= ~_BV(PIN_RF_TX);
+	PORT_RF_CONTROL |=  _BV(PIN_RF_RX);
+}
+
+static void ptt_set_tx(void)
+{
+	/* Switch on-board RX/TX switch to transmit */
+	PORT_RF_CONTROL &= ~_BV(PIN_RF_RX);
+	PORT_RF_CONTROL |=  _BV(PIN_RF_TX);
+#if defined(PIN_EXT_LNA)
+	PORT_RF_CONTROL &= ~_BV(PIN_EXT_LNA);
+
+	/* Power on on-board PA and disable on-board LNA */
+	PORT_PALNA_CONTROL |= _BV(PIN_PA_BIAS_EN);
+#endif
+}
+
+/* Wait at least ms milliseconds from now */
+static inline void ptt_wait_ms(uint16_t ms)
+{
+	ptt_wait = ms ? ms + 1 : 0;
+}
+
+static void ptt_call_done(void)
+{
+	void (*done)(void) = ptt_done;
+
+	ptt_done = NULL;
+	if (done)
+		done();
+}
+
+static void ptt_enter(uint8_t state)
+{
+	ptt_state = state;
+
+	switch (state) {
+	case PTT_KEY_LNA:
+#if defined(PIN_EXT_LNA)
+		/* Power off external LNA and wait for it to switch off */
+		PORT_RF_CONTROL &= ~_BV(PIN_EXT_LNA);
+		ptt_wait_ms(50);
+#endif
+		break;
+	case PTT_KEY_PA:
+		/* Wait for on-board PA and LNA to settle */
+		ptt_set_tx();
+#if defined(PIN_EXT_LNA)
+		ptt_wait_ms(5);
+#endif
+		break;
+	case PTT_KEY_EXT:
+		/* Power on external PA and wait for it to settle */
+#if defined(PIN_EXT_PTT)
+		PORT_PALNA_CONTROL |= _BV(PIN_EXT_PTT);
+#endif
+		ptt_wait_ms(conf.ptt_delay_high);
+		break;
+	case PTT_TX:
+		break;
+	case PTT_RELEASE_EXT:
+		/* Power off external PA and wait for it to settle */
+#if defined(PIN_EXT_PTT)
+		PORT_PALNA_CONTROL &= ~_BV(PIN_EXT_PTT);
+		ptt_wait_ms(conf.ptt_delay_low);
+#endif
+		break;
+	case PTT_RX:
+		ptt_set_rx();
+		break;
+	}
+}
+
+/* Step through the sequence until it has to wait or is done */
+static void ptt_run(void)
+{
+	while (!ptt_wait) {
+		switch (ptt_state) {
+		case PTT_RX:
+			if (!ptt_want_tx) {
+				ptt_call_done();
+				return;
+			}
+			ptt_enter(PTT_KEY_LNA);
+			break;
+		case PTT_KEY_LNA:
+			ptt_enter(PTT_KEY_PA);
+			break;
+		case PTT_KEY_PA:
+			ptt_enter(PTT_KEY_EXT);
+			break;
+		case PTT_KEY_EXT:
+			ptt_enter(PTT_TX);
+			break;
+		case PTT_TX:
+			if (ptt_want_tx) {
+				ptt_call_done();
+				return;
+			}
+			ptt_enter(PTT_RELEASE_EXT);
+			break;
+		case PTT_RELEASE_EXT:
+			ptt_enter(PTT_RX);
+			break;
+		}
+	}
+}
+
+void ptt_key(void (*keyed)(void))
+{
+	uint8_t sreg = SREG;
+
+	cli();
+	ptt_want_tx = true;
+	ptt_done = keyed;
+	ptt_run();
+	SREG = sreg;
+}
+
+void ptt_release(void (*released)(void))
+{
+	uint8_t sreg = SREG;
+
+	cli();
+	ptt_want_tx = false;
+	ptt_done = released;
+	ptt_run();
+	SREG = sreg;
+}
+
+void ptt_tick(void)
+{
+	if (ptt_wait && !--ptt_wait)
+		ptt_run();
+}
+
+void ptt_init(void)
+{
+	DIR_RF_CONTROL    |= _BV(PIN_RF_TX) | _BV(PIN_RF_RX);
+#if defined(PIN_EXT_LNA)
+	DIR_RF_CONTROL    |= _BV(PIN_EXT_LNA);
+	DIR_PALNA_CONTROL |= _BV(PIN_PA_BIAS_EN) | _BV(PIN_EXT_PTT);
+#endif
+	ptt_enter(PTT_RX);
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "sched.h"
+#include "timer.h"
+
+/* Pending events and the time the first of them was posted */
+static volatile uint8_t events = 0;
+static volatile uint32_t posted_us;
+
+/* Only updated from the main loop, with interrupts disabled */
+static uint32_t start_us;
+static uint32_t idle_us;
+static uint32_t dispatches;
+static uint32_t latency_sum;
+static uint32_t latency_min;
+static uint32_t latency_max;
+
+void sched_init(void)
+{
+	/* Timers, SPI and USB keep running and wake the CPU */
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sched_reset();
+}
+
+/* Safe to call from interrupt context */
+void sched_post(uint8_t ev)
+{
+	uint8_t sreg = SREG;
+
+	cli();
+	if (!events)
+		posted_us = timer_us();
+	events |= ev;
+	SREG = sreg;
+}
+
+/* Sleep until an event is posted, then return and clear all pending
+ * events */
+uint8_t sched_wait(void)
+{
+	uint32_t sleep_us, latency;
+	uint8_t ev;
+
+	cli();
+
+	while (!events) {
+		sleep_us = timer_us();
+
+		/* The instruction after sei() runs before any interrupt, so
+		 * an event can not slip in before the CPU sleeps */
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		cli();
+
+		idle_us += timer_us() - sleep_us;
+	}
+
+	ev = events;
+	events = 0;
+
+	latency = timer_us() - posted_us;
+	if (latency < latency_min)
+		latency_min = latency;
+	if (latency > latency_max)
+		latency_max = latency;
+	latency_sum += latency;
+	dispatches++;
+
+	sei();
+
+	return ev;
+}
+
+void sched_reset(void)
+{
+	uint8_t sreg = SREG;
+
+	cli();
+	start_us = timer_us();
+	idle_us = 0;
+	dispatches = 0;
+	latency_sum = 0;
+	latency_min = UINT32_MAX;
+	latency_max = 0;
+	SREG = sreg;
+}
+
+void sched_get_report(struct sched_report *report)
+{
+	cli();
+	report->elapsed_us = timer_us() - start_us;
+	report->idle_us = idle_us;
+	report->dispatches = dispatches;
+	report->latency_min = dispatches ? latency_min : 0;
+	report->latency_avg = dispatches ? latency_sum / dispatches : 0;
+	report->latency_max = latency_max;
+	sei();
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <stdint.h>
+
+/* Events that make the main loop run its tasks */
+#define EVENT_TICK		0x01	/* System tick, polled tasks and USB */
+#define EVENT_RX		0x02	/* Frame started or completed */
+#define EVENT_CONF		0x04	/* Configuration changed */
+
+/* Times in microseconds. Latency is from the first event posted to the
+ * main loop picking it up, idle time includes the ISR that woke it */
+struct sched_report {
+	uint32_t elapsed_us;
+	uint32_t idle_us;
+	uint32_t dispatches;
+	uint32_t latency_min;
+	uint32_t latency_avg;
+	uint32_t latency_max;
+} __attribute__ ((packed));
+
+void sched_init(void);
+void sched_post(uint8_t events);
+uint8_t sched_wait(void);
+void sched_reset(void);
+void sched_get_report(struct sched_report *report);
+
+#endif /* _SCHED_H_ */
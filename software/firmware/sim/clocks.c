@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Compares the integer clock and N divider math in adf7021.c with the
+ * floating point code it replaced, transcribed with AVR semantics:
+ * double is IEEE single precision and int is 16 bits.
+ *
+ * The clock dividers, discriminator and post demodulation bandwidths
+ * and the frequency deviation must match for every bitrate and
+ * modulation index the configuration accepts. The N divider may differ,
+ * as the single precision quotient is not exact, but the integer one
+ * must be the exact rounding and never further from the requested
+ * frequency than the old one.
+ *
+ * usage: clocks [step]   N divider checked every step Hz, default 997 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bluebox.h"
+#include "../adf7021.c"
+
+#define XTAL		16000000UL
+
+struct bluebox_config conf;
+volatile uint8_t sim_io[SIM_REGS];
+
+/* Not reached from the functions under test */
+volatile uint8_t *sim_reg(uint8_t reg) { return &sim_io[reg]; }
+volatile uint16_t *sim_tcnt1(void) { static uint16_t t; return &t; }
+void sim_delay_cycles(uint64_t cycles) { }
+void ptt_release(void (*released)(void)) { }
+uint32_t timer_us(void) { return 0; }
+
+struct clocks {
+	uint8_t dem, cdr, fd, inv, dot;
+	uint16_t rate, disc, post;
+};
+
+static bool old_clocks(uint16_t data_rate, uint8_t mod_index, struct clocks *r)
+{
+	float dr = data_rate, mi = mod_index;
+	float freq_dev, demod_clk, real_dr;
+	uint16_t real_rate;
+	uint8_t tfd, dem = 0, cdr_final;
+	uint16_t k, cdr, disc;
+	int16_t w = INT16_MAX, residual;
+	int16_t i;
+
+	tfd = (uint8_t)(int32_t)roundf((mi * 0.5f * dr * 65536.0f) / (0.5f * (float)XTAL));
+	if (!tfd)
+		return false;
+
+	freq_dev = (float)(uint32_t)(tfd * XTAL) / 65536.0f;
+	k = (uint16_t)(uint32_t)roundf(100000 / freq_dev);
+
+	for (i = 1; i < 15; i++) {
+		demod_clk = (float)XTAL / i;
+		disc = (uint16_t)(uint32_t)roundf((k * demod_clk) / 400000);
+		cdr = (uint16_t)(uint32_t)roundf(demod_clk / (dr * 32));
+		if (disc > 660 || cdr > 255)
+			continue;
+		if (!cdr)
+			return false;
+		real_dr = XTAL / ((float)i * (float)cdr * 32.0f);
+		residual = abs((int16_t)(int32_t)((float)(uint16_t)(uint32_t)real_dr - dr));
+		if (w > residual) {
+			w = residual;
+			dem = i;
+		}
+	}
+
+	if (!dem)
+		return false;
+
+	demod_clk = (float)XTAL / dem;
+	cdr_final = (uint8_t)(uint16_t)(uint32_t)roundf(demod_clk / (dr * 32));
+	if (!cdr_final)
+		return false;
+
+	/* Stored in the 16 bit real.data_rate before the rest used it */
+	real_rate = (uint16_t)(uint32_t)(XTAL / ((float)dem * (float)cdr_final * 32.0f));
+	r->rate = real_rate;
+	r->fd = (uint8_t)(int32_t)roundf((mi * 0.5f * real_rate * 65536.0f) / (0.5f * (float)XTAL));
+	r->disc = (uint16_t)(uint32_t)roundf((k * demod_clk) / 400000) & 0x3ff;
+	r->post = (uint16_t)(uint32_t)roundf(((real_rate * 0.75f) * 3.141592654f * 2048.0f) / demod_clk) & 0x3ff;
+	r->dem = dem;
+	r->cdr = cdr_final;
+
+	if (k & 1) {
+		r->inv = (((k + 1) / 2) & 1) ? 2 : 0;
+		r->dot = 1;
+	} else {
+		r->inv = ((k / 2) & 1) ? 2 : 0;
+		r->dot = 0;
+	}
+
+	return true;
+}
+
+static uint32_t old_n(uint32_t freq)
+{
+	float n = (float)freq / ((float)XTAL * 0.5f);
+
+	return (uint32_t)floorf(n) * 32768 + (((uint32_t)roundf((n - floorf(n)) * 32768)) & 0x7fff);
+}
+
+/* Exact N in units of 1/32768, rounded to nearest */
+static uint32_t exact_n(uint32_t freq)
+{
+	return ((uint64_t)freq * 32768 * 2 + XTAL / 2) / XTAL;
+}
+
+static uint64_t n_error(uint32_t n, uint32_t freq)
+{
+	int64_t diff = (int64_t)n * XTAL - (int64_t)freq * 32768 * 2;
+
+	return diff < 0 ? -diff : diff;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t step = argc > 1 ? strtoul(argv[1], NULL, 0) : 997;
+	uint32_t rate, mi, freq, n, old;
+	uint32_t combos = 0, overflow = 0, differ = 0;
+	uint32_t freqs = 0, n_differ = 0, n_wrong = 0, n_worse = 0;
+	struct clocks o;
+	adf_conf_t c;
+
+	if (!step)
+		step = 1;
+
+	adf_set_power_on(XTAL);
+
+	for (rate = CONFIG_BITRATE_MIN; rate <= CONFIG_BITRATE_MAX; rate++) {
+		for (mi = 1; mi <= 255; mi++) {
+			if (!old_clocks(rate, mi, &o))
+				continue;
+
+			/* Past the 8 bit deviation register both versions
+			 * go on with a truncated deviation, nothing to match */
+			if (div_round(mi * rate * 64, XTAL >> 10) > 255) {
+				overflow++;
+				continue;
+			}
+
+			memset(&c, 0, sizeof(c));
+			c.desired.data_rate = rate;
+			c.desired.mod_index = mi;
+			adf_find_clocks(&c);
+			combos++;
+
+			if (o.dem != c.r3.dem_clk_divide || o.cdr != c.r3.cdr_clk_divide ||
+			    o.rate != c.real.data_rate || o.disc != c.r4.disc_bw || o.post != c.r4.post_demod_bw ||
+			    o.fd != c.real.freq_dev || o.inv != c.r4.rx_invert || o.dot != c.r4.dot_product) {
+				if (differ++ < 10)
+					printf("clocks differ at %u bps, index %u\n", rate, mi);
+			}
+		}
+	}
+
+	printf("clocks     %u combinations, %u differ, %u skipped with a deviation over 8 bits\n",
+	       combos, differ, overflow);
+
+	for (freq = CONFIG_FREQ_MIN; freq <= CONFIG_FREQ_MAX; freq += step) {
+		memset(&c, 0, sizeof(c));
+		adf_find_n(&c, freq);
+		n = c.r0.int_n * 32768 + c.r0.frac_n;
+		old = old_n(freq);
+		freqs++;
+
+		if (n != exact_n(freq) && n_wrong++ < 10)
+			printf("N not exact at %u Hz\n", freq);
+		if (n == old)
+			continue;
+		n_differ++;
+		if (n_error(n, freq) > n_error(old, freq) && n_worse++ < 10)
+			printf("N further off than the old one at %u Hz\n", freq);
+	}
+
+	printf("N divider  %u frequencies, %u differ from the old code, %u not exact, %u further off\n",
+	       freqs, n_differ, n_wrong, n_worse);
+
+	if (differ || n_wrong || n_worse) {
+		printf("FAIL clocks\n");
+		return 1;
+	}
+
+	printf("PASS clocks\n");
+	return 0;
+}
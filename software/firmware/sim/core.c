@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Simulated ATmega32U4/U2 core: the I/O register file, Timer0 and
+ * Timer1, interrupt dispatch and the simulated time. The firmware runs
+ * on its own stack and hands control back to the test scenario when it
+ * sleeps, once the requested amount of time has passed. Instructions
+ * take no time, so only the order of events is simulated, not the
+ * load of the CPU */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "sim.h"
+
+#define SIM_STACK_SIZE		(256 * 1024)
+
+/* Timer0 in CTC mode at F_CPU/64 once timer_init() has started it,
+ * Timer1 free running at F_CPU/8 */
+#define TIMER0_CYCLES		((uint64_t)(sim_io[SIM_OCR0A] + 1) * 64)
+#define TIMER1_CYCLES		((uint64_t)65536 * 8)
+
+volatile uint8_t sim_io[SIM_REGS];
+uint64_t sim_cycles;
+
+static uint64_t timer0_next = SIM_NEVER;
+static uint64_t timer1_next = TIMER1_CYCLES;
+static uint64_t host_next = SIM_CYCLES_PER_MS;
+static uint16_t tcnt1;
+
+/* Firmware and test scenario contexts */
+static ucontext_t fw_context;
+static ucontext_t test_context;
+static bool fw_started;
+static uint64_t run_until;
+
+int bluebox_main(void);
+
+/* Only one of the sync word handlers exists for each board */
+#pragma weak INT6_vect
+#pragma weak PCINT0_vect
+
+/* Returns true if the vector was taken */
+static bool sim_vector(volatile uint8_t *flags, uint8_t flag, bool enabled, void (*vector)(void))
+{
+	if (!(*flags & flag) || !enabled || !vector)
+		return false;
+
+	/* The flag is cleared when the vector is executed, and the handler
+	 * runs with interrupts disabled until it returns */
+	*flags &= ~flag;
+	sim_io[SIM_SREG] &= ~_BV(SREG_I);
+	vector();
+	sim_io[SIM_SREG] |= _BV(SREG_I);
+
+	return true;
+}
+
+/* Take pending interrupts in order of their vector number */
+void sim_dispatch(void)
+{
+	while (sim_io[SIM_SREG] & _BV(SREG_I)) {
+		if (sim_vector(&sim_io[SIM_EIFR], _BV(INTF6), sim_io[SIM_EIMSK] & _BV(INT6), INT6_vect))
+			continue;
+		if (sim_vector(&sim_io[SIM_PCIFR], _BV(PCIF0), sim_io[SIM_PCICR] & _BV(PCIE0), PCINT0_vect))
+			continue;
+		if (sim_vector(&sim_io[SIM_TIFR1], _BV(TOV1), sim_io[SIM_TIMSK1] & _BV(TOIE1), TIMER1_OVF_vect))
+			continue;
+		if (sim_vector(&sim_io[SIM_TIFR0], _BV(OCF0A), sim_io[SIM_TIMSK0] & _BV(OCIE0A), TIMER0_COMPA_vect))
+			continue;
+		if (sim_vector(&sim_io[SIM_SPSR], _BV(SPIF),
+			       (sim_io[SIM_SPCR] & (_BV(SPE) | _BV(SPIE))) == (_BV(SPE) | _BV(SPIE)), SPI_STC_vect))
+			continue;
+		break;
+	}
+}
+
+void sim_cli(void)
+{
+	sim_io[SIM_SREG] &= ~_BV(SREG_I);
+}
+
+void sim_sei(void)
+{
+	sim_io[SIM_SREG] |= _BV(SREG_I);
+	sim_dispatch();
+}
+
+/* Every register access by the firmware passes here. Interrupts that
+ * became pending while they were disabled are taken at the next access
+ * after SREG has been restored, and the radio sees pin changes before
+ * the firmware reads its inputs */
+volatile uint8_t *sim_reg(uint8_t reg)
+{
+	sim_dispatch();
+	radio_pins();
+
+	return &sim_io[reg];
+}
+
+volatile uint16_t *sim_tcnt1(void)
+{
+	sim_dispatch();
+	tcnt1 = (sim_cycles / 8) & 0xFFFF;
+
+	return &tcnt1;
+}
+
+static uint64_t sim_next_event(void)
+{
+	uint64_t next;
+
+	if (timer0_next == SIM_NEVER && sim_io[SIM_TCCR0B])
+		timer0_next = sim_cycles + TIMER0_CYCLES;
+
+	next = timer0_next;
+
+	if (timer1_next < next)
+		next = timer1_next;
+	if (host_next < next)
+		next = host_next;
+	if (radio_next_event() < next)
+		next = radio_next_event();
+
+	return next;
+}
+
+/* Advance the time to target, raising interrupt flags on the way */
+static void sim_advance(uint64_t target)
+{
+	uint64_t next;
+
+	while ((next = sim_next_event()) <= target) {
+		sim_cycles = next;
+
+		if (next == host_next) {
+			host_next += SIM_CYCLES_PER_MS;
+			usb_tick();
+		}
+		if (next == timer0_next) {
+			timer0_next += TIMER0_CYCLES;
+			sim_io[SIM_TIFR0] |= _BV(OCF0A);
+		}
+		if (next == timer1_next) {
+			timer1_next += TIMER1_CYCLES;
+			sim_io[SIM_TIFR1] |= _BV(TOV1);
+		}
+		if (next == radio_next_event())
+			radio_event();
+
+		sim_dispatch();
+	}
+
+	sim_cycles = target;
+}
+
+void sim_delay_cycles(uint64_t cycles)
+{
+	sim_advance(sim_cycles + cycles);
+}
+
+/* Called from sched_wait() with interrupts enabled. Wakes up on the
+ * next event, or returns to the test scenario once its time is up */
+void sim_sleep(void)
+{
+	uint64_t next = sim_next_event();
+
+	if (next > run_until) {
+		sim_cycles = run_until;
+		swapcontext(&fw_context, &test_context);
+		return;
+	}
+
+	sim_advance(next);
+}
+
+void sim_reset(void)
+{
+	fprintf(stderr, "sim: watchdog reset at %u ms\n", sim_ms());
+	exit(2);
+}
+
+void jump_to_bootloader(void)
+{
+	fprintf(stderr, "sim: bootloader jump at %u ms\n", sim_ms());
+	exit(2);
+}
+
+static void sim_firmware(void)
+{
+	bluebox_main();
+
+	fprintf(stderr, "sim: firmware returned from main\n");
+	exit(2);
+}
+
+void sim_run_ms(uint32_t ms)
+{
+	static char stack[SIM_STACK_SIZE];
+
+	run_until = sim_cycles + (uint64_t)ms * SIM_CYCLES_PER_MS;
+
+	if (!fw_started) {
+		fw_started = true;
+		radio_init();
+		getcontext(&fw_context);
+		fw_context.uc_stack.ss_sp = stack;
+		fw_context.uc_stack.ss_size = sizeof(stack);
+		fw_context.uc_link = NULL;
+		makecontext(&fw_context, sim_firmware, 0);
+	}
+
+	swapcontext(&test_context, &fw_context);
+}
+
+bool sim_run_until(bool (*done)(void), uint32_t timeout_ms)
+{
+	uint32_t end = sim_ms() + timeout_ms;
+
+	while (!done()) {
+		if (sim_ms() >= end)
+			return false;
+		sim_run_ms(1);
+	}
+
+	return true;
+}
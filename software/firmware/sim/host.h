@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _SIM_HOST_H_
+#define _SIM_HOST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Called with each complete transfer read from the IN endpoint */
+typedef void (*host_in_handler)(const uint8_t *data, uint16_t len);
+
+/* Select INTERRUPT_CONFIGURATION or BULK_CONFIGURATION before the
+ * firmware is started */
+void host_configure(uint8_t configuration);
+
+/* Queue a frame on the OUT endpoint as a TOTAL_LENGTH transfer */
+bool host_send_frame(const uint8_t *data, uint16_t size);
+
+/* Queue raw bytes on the OUT endpoint, split into packets */
+bool host_send_bytes(const uint8_t *data, uint16_t len);
+
+/* OUT packets not yet taken by the firmware */
+uint16_t host_out_pending(void);
+
+/* Stop or resume reading the IN endpoint */
+void host_read(bool enabled);
+void host_on_in(host_in_handler handler);
+
+/* Vendor control requests. Both return the number of bytes transferred
+ * in the data stage, or HOST_CONTROL_STALLED */
+#define HOST_CONTROL_STALLED	0xFFFF
+
+uint16_t host_control_out(uint8_t request, uint16_t value, const void *data, uint16_t len);
+uint16_t host_control_in(uint8_t request, uint16_t value, void *data, uint16_t len);
+
+#endif /* _SIM_HOST_H_ */
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _SIM_LUFA_USB_H_
+#define _SIM_LUFA_USB_H_
+
+/* The part of the LUFA device API used by the firmware, implemented by
+ * the simulated USB controller in sim/usb.c. Stream functions follow
+ * LUFA's semantics, including resumable transfers through
+ * BytesProcessed */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+
+#define ATTR_WARN_UNUSED_RESULT
+#define ATTR_NON_NULL_PTR_ARG(...)
+
+#ifndef USB_STREAM_TIMEOUT_MS
+#define USB_STREAM_TIMEOUT_MS			100
+#endif
+
+#define ENDPOINT_DIR_OUT			0x00
+#define ENDPOINT_DIR_IN				0x80
+
+#define ENDPOINT_RWSTREAM_NoError		0
+#define ENDPOINT_RWSTREAM_EndpointStalled	1
+#define ENDPOINT_RWSTREAM_DeviceDisconnected	2
+#define ENDPOINT_RWSTREAM_BusSuspended		3
+#define ENDPOINT_RWSTREAM_Timeout		4
+#define ENDPOINT_RWSTREAM_IncompleteTransfer	5
+
+#define ENDPOINT_RWCSTREAM_NoError		0
+#define ENDPOINT_RWCSTREAM_HostAborted		1
+
+#define DEVICE_STATE_Unattached			0
+#define DEVICE_STATE_Powered			1
+#define DEVICE_STATE_Default			2
+#define DEVICE_STATE_Addressed			3
+#define DEVICE_STATE_Configured			4
+#define DEVICE_STATE_Suspended			5
+
+#define REQDIR_HOSTTODEVICE			(0 << 7)
+#define REQDIR_DEVICETOHOST			(1 << 7)
+#define REQTYPE_STANDARD			(0 << 5)
+#define REQTYPE_CLASS				(1 << 5)
+#define REQTYPE_VENDOR				(2 << 5)
+#define REQREC_DEVICE				(0 << 0)
+#define REQREC_INTERFACE			(1 << 0)
+
+typedef struct {
+	uint8_t Size;
+	uint8_t Type;
+} __attribute__ ((packed)) USB_Descriptor_Header_t;
+
+typedef struct {
+	USB_Descriptor_Header_t Header;
+	uint16_t TotalConfigurationSize;
+	uint8_t TotalInterfaces;
+	uint8_t ConfigurationNumber;
+	uint8_t ConfigurationStrIndex;
+	uint8_t ConfigAttributes;
+	uint8_t MaxPowerConsumption;
+} __attribute__ ((packed)) USB_Descriptor_Configuration_Header_t;
+
+typedef struct {
+	USB_Descriptor_Header_t Header;
+	uint8_t InterfaceNumber;
+	uint8_t AlternateSetting;
+	uint8_t TotalEndpoints;
+	uint8_t Class;
+	uint8_t SubClass;
+	uint8_t Protocol;
+	uint8_t InterfaceStrIndex;
+} __attribute__ ((packed)) USB_Descriptor_Interface_t;
+
+typedef struct {
+	USB_Descriptor_Header_t Header;
+	uint8_t EndpointAddress;
+	uint8_t Attributes;
+	uint16_t EndpointSize;
+	uint8_t PollingIntervalMS;
+} __attribute__ ((packed)) USB_Descriptor_Endpoint_t;
+
+typedef struct {
+	uint8_t bmRequestType;
+	uint8_t bRequest;
+	uint16_t wValue;
+	uint16_t wIndex;
+	uint16_t wLength;
+} __attribute__ ((packed)) USB_Request_Header_t;
+
+extern USB_Request_Header_t USB_ControlRequest;
+extern volatile uint8_t USB_DeviceState;
+extern uint8_t USB_Device_ConfigurationNumber;
+
+#define GlobalInterruptEnable()		sei()
+#define GlobalInterruptDisable()	cli()
+
+void USB_Init(void);
+
+void Endpoint_SelectEndpoint(uint8_t address);
+bool Endpoint_IsINReady(void);
+bool Endpoint_IsOUTReceived(void);
+bool Endpoint_IsReadWriteAllowed(void);
+uint16_t Endpoint_BytesInEndpoint(void);
+void Endpoint_ClearIN(void);
+void Endpoint_ClearOUT(void);
+void Endpoint_ClearSETUP(void);
+void Endpoint_StallTransaction(void);
+
+uint8_t Endpoint_Write_Stream_LE(const void *buffer, uint16_t length, uint16_t *processed);
+uint8_t Endpoint_Read_Stream_LE(void *buffer, uint16_t length, uint16_t *processed);
+uint8_t Endpoint_Discard_Stream(uint16_t length, uint16_t *processed);
+uint8_t Endpoint_Write_Control_Stream_LE(const void *buffer, uint16_t length);
+uint8_t Endpoint_Read_Control_Stream_LE(void *buffer, uint16_t length);
+
+void EVENT_USB_Device_ControlRequest(void);
+
+#endif /* _SIM_LUFA_USB_H_ */
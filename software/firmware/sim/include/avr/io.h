@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _SIM_AVR_IO_H_
+#define _SIM_AVR_IO_H_
+
+#include <stdint.h>
+
+/* I/O registers of the simulated ATmega32U4/U2. Firmware accesses go
+ * through sim_reg(), so the simulator sees every pin change and can
+ * update inputs before they are read. The simulator itself is built
+ * with SIM_RAW_IO and accesses the register file directly */
+enum sim_reg {
+	SIM_PORTB, SIM_PORTC, SIM_PORTD, SIM_PORTE, SIM_PORTF,
+	SIM_PINB, SIM_PINC, SIM_PIND, SIM_PINE, SIM_PINF,
+	SIM_DDRB, SIM_DDRC, SIM_DDRD, SIM_DDRE, SIM_DDRF,
+	SIM_SPCR, SIM_SPSR, SIM_SPDR,
+	SIM_EICRB, SIM_EIMSK, SIM_EIFR,
+	SIM_PCICR, SIM_PCIFR, SIM_PCMSK0,
+	SIM_MCUSR, SIM_SMCR, SIM_SREG,
+	SIM_TCCR0A, SIM_TCCR0B, SIM_OCR0A, SIM_TIMSK0, SIM_TIFR0,
+	SIM_TCCR1A, SIM_TCCR1B, SIM_TIMSK1, SIM_TIFR1,
+	SIM_REGS
+};
+
+extern volatile uint8_t sim_io[SIM_REGS];
+
+volatile uint8_t *sim_reg(uint8_t reg);
+volatile uint16_t *sim_tcnt1(void);
+
+#if defined(SIM_RAW_IO)
+#define SIM_IO(reg)	(sim_io[reg])
+#else
+#define SIM_IO(reg)	(*sim_reg(reg))
+#endif
+
+#define PORTB		SIM_IO(SIM_PORTB)
+#define PORTC		SIM_IO(SIM_PORTC)
+#define PORTD		SIM_IO(SIM_PORTD)
+#define PORTE		SIM_IO(SIM_PORTE)
+#define PORTF		SIM_IO(SIM_PORTF)
+#define PINB		SIM_IO(SIM_PINB)
+#define PINC		SIM_IO(SIM_PINC)
+#define PIND		SIM_IO(SIM_PIND)
+#define PINE		SIM_IO(SIM_PINE)
+#define PINF		SIM_IO(SIM_PINF)
+#define DDRB		SIM_IO(SIM_DDRB)
+#define DDRC		SIM_IO(SIM_DDRC)
+#define DDRD		SIM_IO(SIM_DDRD)
+#define DDRE		SIM_IO(SIM_DDRE)
+#define DDRF		SIM_IO(SIM_DDRF)
+#define SPCR		SIM_IO(SIM_SPCR)
+#define SPSR		SIM_IO(SIM_SPSR)
+#define SPDR		SIM_IO(SIM_SPDR)
+#define EICRB		SIM_IO(SIM_EICRB)
+#define EIMSK		SIM_IO(SIM_EIMSK)
+#define EIFR		SIM_IO(SIM_EIFR)
+#define PCICR		SIM_IO(SIM_PCICR)
+#define PCIFR		SIM_IO(SIM_PCIFR)
+#define PCMSK0		SIM_IO(SIM_PCMSK0)
+#define MCUSR		SIM_IO(SIM_MCUSR)
+#define SMCR		SIM_IO(SIM_SMCR)
+#define SREG		SIM_IO(SIM_SREG)
+#define TCCR0A		SIM_IO(SIM_TCCR0A)
+#define TCCR0B		SIM_IO(SIM_TCCR0B)
+#define OCR0A		SIM_IO(SIM_OCR0A)
+#define TIMSK0		SIM_IO(SIM_TIMSK0)
+#define TIFR0		SIM_IO(SIM_TIFR0)
+#define TCCR1A		SIM_IO(SIM_TCCR1A)
+#define TCCR1B		SIM_IO(SIM_TCCR1B)
+#define TIMSK1		SIM_IO(SIM_TIMSK1)
+#define TIFR1		SIM_IO(SIM_TIFR1)
+#define TCNT1		(*sim_tcnt1())
+
+#define _BV(bit)	(1 << (bit))
+#define _SFR_IO_ADDR(reg)	0
+
+/* SPCR, SPSR */
+#define SPIE		7
+#define SPE		6
+#define DORD		5
+#define MSTR		4
+#define CPOL		3
+#define CPHA		2
+#define SPR1		1
+#define SPR0		0
+#define SPIF		7
+#define WCOL		6
+#define SPI2X		0
+
+/* DDRB, PORTB */
+#define DDB0		0
+#define DDB1		1
+#define DDB2		2
+#define DDB3		3
+#define PB0		0
+
+/* External and pin change interrupts */
+#define ISC60		4
+#define ISC61		5
+#define INT6		6
+#define INTF6		6
+#define PCIE0		0
+#define PCIF0		0
+#define PCINT5		5
+
+/* MCUSR, SMCR */
+#define WDRF		3
+#define SE		0
+
+/* Timers */
+#define WGM01		1
+#define CS00		0
+#define CS01		1
+#define CS02		2
+#define OCIE0A		1
+#define OCF0A		1
+#define CS10		0
+#define CS11		1
+#define CS12		2
+#define TOIE1		0
+#define TOV1		0
+
+/* SREG */
+#define SREG_I		7
+
+#endif /* _SIM_AVR_IO_H_ */
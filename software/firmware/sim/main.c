@@ -0,0 +1,463 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Regression scenarios and throughput benchmark for the host
+ * simulation. Each scenario runs the unmodified firmware against the
+ * virtual ADF7021 and USB host from a fresh process, and exits nonzero
+ * if any check fails */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bluebox.h"
+#include "stats.h"
+#include "sim.h"
+#include "radio.h"
+#include "host.h"
+
+/* Time for the firmware to start and settle in RX */
+#define BOOT_MS			500
+
+#define RX_FRAMES		16
+#define RX_RSSI			-90
+#define TX_FRAMES		8
+#define BENCH_FRAMES		32
+
+#define MAX_FRAMES		64
+
+struct config_seq {
+	uint16_t staged;
+	uint16_t active;
+} __attribute__ ((packed));
+
+static int failures;
+
+#define check(cond, ...) do {						\
+		if (!(cond)) {						\
+			failures++;					\
+			printf("FAIL %s:%d: ", __FILE__, __LINE__);	\
+			printf(__VA_ARGS__);				\
+			printf("\n");					\
+		}							\
+	} while (0)
+
+/* Frames seen by the host, and frames decoded from the air */
+static struct {
+	uint16_t len;
+	uint32_t ms;
+	struct rx_header hdr;
+	uint8_t data[DATA_LENGTH];
+} rx[MAX_FRAMES];
+static unsigned int rx_count;
+
+static struct {
+	uint16_t len;
+	uint16_t training;
+	uint32_t ms;
+	uint8_t data[DATA_LENGTH];
+} tx[MAX_FRAMES];
+static unsigned int tx_count;
+
+static void on_in(const uint8_t *data, uint16_t len)
+{
+	struct rx_header hdr;
+
+	if (rx_count >= MAX_FRAMES || len < sizeof(hdr))
+		return;
+
+	memcpy(&hdr, data, sizeof(hdr));
+	rx[rx_count].hdr = hdr;
+	rx[rx_count].len = len - sizeof(hdr);
+	rx[rx_count].ms = sim_ms();
+	memcpy(rx[rx_count].data, data + sizeof(hdr),
+	       rx[rx_count].len < DATA_LENGTH ? rx[rx_count].len : DATA_LENGTH);
+	rx_count++;
+}
+
+static void on_tx(const uint8_t *data, uint16_t len, uint16_t training)
+{
+	if (tx_count >= MAX_FRAMES)
+		return;
+
+	tx[tx_count].len = len;
+	tx[tx_count].training = training;
+	tx[tx_count].ms = sim_ms();
+	memcpy(tx[tx_count].data, data, len);
+	tx_count++;
+}
+
+/* Frame contents depend on the frame number and position */
+static void frame_fill(uint8_t *data, uint16_t len, unsigned int n)
+{
+	uint16_t i;
+
+	for (i = 0; i < len; i++)
+		data[i] = (uint8_t)(n * 31 + i * 7 + (i >> 8));
+}
+
+static bool frame_check(const uint8_t *data, uint16_t len, unsigned int n)
+{
+	uint8_t expect[DATA_LENGTH];
+
+	frame_fill(expect, len, n);
+
+	return !memcmp(data, expect, len);
+}
+
+static uint8_t frame_fsm(unsigned int n)
+{
+	return (n & 1) ? LONG_FRAME_MARKER : SHORT_FRAME_MARKER;
+}
+
+/* Air time of a frame at the current bitrate, with some margin */
+static uint32_t frame_ms(uint16_t len)
+{
+	return (uint32_t)(CALLSIGN_LENGTH + FSM_LENGTH + len) * BITS_PER_BYTE * 1000 / conf.bitrate + 20;
+}
+
+/* Put frame n on air at at_ms, returns its air time */
+static uint32_t air_frame(unsigned int n, uint32_t at_ms)
+{
+	uint8_t air[CALLSIGN_LENGTH + FSM_LENGTH + DATA_LENGTH];
+	uint8_t fsm = frame_fsm(n);
+	uint16_t len = radio_frame_length(fsm);
+
+	memcpy(air, conf.callsign + SYNC_WORD_LENGTH, CUB_LENGTH);
+	air[CUB_LENGTH] = fsm;
+	frame_fill(&air[CUB_LENGTH + FSM_LENGTH], len, n);
+	radio_send(air, CUB_LENGTH + FSM_LENGTH + len, at_ms);
+
+	return frame_ms(len);
+}
+
+static void host_frame(unsigned int n)
+{
+	uint8_t data[DATA_LENGTH];
+	uint16_t len = radio_frame_length(frame_fsm(n));
+
+	frame_fill(data, len, n);
+	host_send_frame(data, len);
+}
+
+static void get_stats(struct bluebox_stats *s)
+{
+	host_control_in(REQUEST_STATS, 0, s, sizeof(*s));
+}
+
+static bool rx_all(void)
+{
+	return rx_count >= RX_FRAMES;
+}
+
+static bool tx_all(void)
+{
+	return tx_count >= TX_FRAMES;
+}
+
+static bool tx_released(void)
+{
+	return !radio_tx_on();
+}
+
+static void boot(void)
+{
+	host_on_in(on_in);
+	radio_on_tx(on_tx);
+	sim_run_ms(BOOT_MS);
+	check(!radio_tx_on(), "transmitter on after boot");
+}
+
+/* Frames received back to back are delivered intact and in order */
+static void scenario_rx(void)
+{
+	uint32_t at = sim_ms() + 10;
+	unsigned int i;
+
+	radio_set_rssi(RX_RSSI);
+	for (i = 0; i < RX_FRAMES; i++)
+		at += air_frame(i, at);
+
+	check(sim_run_until(rx_all, at + 1000), "%u of %u frames delivered", rx_count, RX_FRAMES);
+
+	for (i = 0; i < rx_count; i++) {
+		check(rx[i].len == radio_frame_length(frame_fsm(i)), "frame %u length %u", i, rx[i].len);
+		check(rx[i].hdr.size == rx[i].len, "frame %u header size %u", i, rx[i].hdr.size);
+		check(!!(rx[i].hdr.flags & FLAG_LONG_FRAME) == (frame_fsm(i) == LONG_FRAME_MARKER),
+		      "frame %u flags %02x", i, rx[i].hdr.flags);
+		check(rx[i].hdr.seq == (uint16_t)(rx[0].hdr.seq + i), "frame %u seq %u", i, rx[i].hdr.seq);
+		check(frame_check(rx[i].data, rx[i].len, i), "frame %u data", i);
+		check(!(rx[i].hdr.flags & FLAG_NO_READBACK) && rx[i].hdr.rssi == RX_RSSI,
+		      "frame %u rssi %d flags %02x", i, rx[i].hdr.rssi, rx[i].hdr.flags);
+	}
+
+	check(radio_stats.missed == 0, "%u frames missed", radio_stats.missed);
+	check(radio_stats.overruns == 0, "%u SPI overruns", radio_stats.overruns);
+}
+
+/* With the host not reading, the ring holds RX_RING_SIZE frames and the
+ * rest are counted as overflow */
+static void scenario_rx_stall(void)
+{
+	struct bluebox_stats s;
+	uint32_t at = sim_ms() + 10;
+	unsigned int i, frames = RX_RING_SIZE + 3;
+
+	host_read(false);
+
+	for (i = 0; i < frames; i++)
+		at += air_frame(i, at);
+
+	sim_run_ms(at - sim_ms() + 100);
+	check(rx_count == 0, "%u frames delivered while stalled", rx_count);
+
+	host_read(true);
+	sim_run_ms(100);
+
+	/* The frame in the IN endpoint was taken from the ring already */
+	get_stats(&s);
+	check(rx_count >= RX_RING_SIZE && rx_count <= RX_RING_SIZE + 1,
+	      "%u frames delivered, ring size %u", rx_count, RX_RING_SIZE);
+	check(rx_count + s.rx_overflow == frames, "%u delivered, %u overflow of %u",
+	      rx_count, s.rx_overflow, frames);
+
+	for (i = 0; i < rx_count; i++)
+		check(frame_check(rx[i].data, rx[i].len, i), "frame %u data", i);
+}
+
+/* Queued frames go out in order, in a single burst if the queue can
+ * hold the next frame while one is sent. Turning around does not
+ * recalibrate the IF filter */
+static void scenario_tx(void)
+{
+	uint32_t if_cals = radio_stats.if_cals;
+	unsigned int i;
+
+	for (i = 0; i < TX_FRAMES; i++)
+		host_frame(i);
+
+	check(sim_run_until(tx_all, 20000), "%u of %u frames sent", tx_count, TX_FRAMES);
+	check(sim_run_until(tx_released, 2000), "transmitter still on");
+
+	for (i = 0; i < tx_count; i++) {
+		check(tx[i].len == radio_frame_length(frame_fsm(i)), "frame %u length %u", i, tx[i].len);
+		check(frame_check(tx[i].data, tx[i].len, i), "frame %u data", i);
+	}
+
+#if TX_QUEUE_SIZE > 1
+	check(radio_stats.keyups == 1, "%u keyups for one burst", radio_stats.keyups);
+#else
+	check(radio_stats.keyups <= TX_FRAMES, "%u keyups for %u frames", radio_stats.keyups, TX_FRAMES);
+#endif
+	check(training_ms_to_bytes(conf.training_ms, conf.bitrate) <= tx[0].training,
+	      "%u training symbols before the first frame", tx[0].training);
+	check(radio_stats.if_cals == if_cals, "%u IF filter calibrations",
+	      radio_stats.if_cals - if_cals);
+}
+
+/* A configuration written during a burst is applied in a gap between
+ * two frames, and no frame is lost */
+static void scenario_tx_reconf(void)
+{
+	uint8_t buf[sizeof(struct config_image) + 1];
+	struct config_image img, cur;
+	struct config_seq seq;
+	uint16_t written;
+	unsigned int i;
+
+	for (i = 0; i < TX_FRAMES; i++)
+		host_frame(i);
+
+	check(sim_run_until(radio_tx_on, 2000), "transmitter not keyed");
+
+	host_control_in(REQUEST_CONFIG, 0, &img, sizeof(img));
+	img.pa_setting = img.pa_setting == CONFIG_PA_MAX ? 1 : CONFIG_PA_MAX;
+
+	/* An image with trailing bytes is refused as a whole */
+	memcpy(buf, &img, sizeof(img));
+	check(host_control_out(REQUEST_CONFIG, 0, buf, sizeof(buf)) == HOST_CONTROL_STALLED,
+	      "over-long configuration not stalled");
+	host_control_in(REQUEST_CONFIG, 0, &cur, sizeof(cur));
+	check(cur.status == CONFIG_STATUS_LENGTH, "config status %u", cur.status);
+	check(cur.pa_setting != img.pa_setting, "over-long configuration staged");
+
+	host_control_out(REQUEST_CONFIG, 0, &img, sizeof(img));
+	host_control_in(REQUEST_CONFIG, 0, &img, sizeof(img));
+	check(img.status == CONFIG_STATUS_OK, "config status %u", img.status);
+
+	host_control_in(REQUEST_CONFIG_SEQ, 0, &seq, sizeof(seq));
+	written = seq.staged;
+	check(seq.active != written, "configuration applied while keyed");
+
+	check(sim_run_until(tx_all, 20000), "%u of %u frames sent", tx_count, TX_FRAMES);
+	sim_run_until(tx_released, 2000);
+
+	host_control_in(REQUEST_CONFIG_SEQ, 0, &seq, sizeof(seq));
+	check(seq.active == written, "active %u, staged %u", seq.active, written);
+	check(conf.pa_setting == img.pa_setting, "PA setting %u, expected %u", conf.pa_setting, img.pa_setting);
+
+	for (i = 0; i < tx_count; i++)
+		check(frame_check(tx[i].data, tx[i].len, i), "frame %u data", i);
+}
+
+/* A host that stops in the middle of a transfer does not keep the
+ * transmitter keyed, and the rest of that transfer is not taken for a
+ * new frame. A host that is slow but keeps sending is waited for */
+static void scenario_tx_stall(void)
+{
+	uint8_t buf[TOTAL_LENGTH];
+	struct tx_header *hdr = (struct tx_header *)buf;
+	struct bluebox_stats s;
+	uint16_t len = radio_frame_length(LONG_FRAME_MARKER);
+	uint16_t pos;
+	uint32_t start;
+
+	memset(buf, 0, sizeof(buf));
+	hdr->size = len;
+	frame_fill(buf + sizeof(*hdr), len, 0);
+	host_send_bytes(buf, 2 * OUT_EPSIZE);
+
+	check(sim_run_until(radio_tx_on, 2000), "transmitter not keyed");
+	start = sim_ms();
+	sim_run_until(tx_released, TX_FILL_TIMEOUT_MS + conf.ptt_delay_low + 1000);
+
+	check(!radio_tx_on(), "transmitter still on after %u ms", sim_ms() - start);
+	check(radio_stats.sent == 0, "%u frames sent", radio_stats.sent);
+
+	get_stats(&s);
+	check(s.tx_fill_timeout == 1, "%u fill timeouts", s.tx_fill_timeout);
+
+	/* The rest arrives late and is dropped, the next transfer goes out
+	 * as usual */
+	host_send_bytes(buf + 2 * OUT_EPSIZE, sizeof(buf) - 2 * OUT_EPSIZE);
+	host_frame(1);
+	check(sim_run_until(tx_all, 5000) || tx_count == 1, "frame after the stall not sent");
+	check(tx_count == 1 && frame_check(tx[0].data, tx[0].len, 1), "frame after the stall corrupt");
+	sim_run_until(tx_released, 2000);
+
+	get_stats(&s);
+	check(s.tx_oversize == 0 && radio_stats.sent == 1, "rest of the stalled transfer taken as a frame");
+
+	/* One packet every two thirds of the timeout */
+	frame_fill(buf + sizeof(*hdr), len, 2);
+	for (pos = 0; pos < sizeof(buf); pos += OUT_EPSIZE) {
+		host_send_bytes(buf + pos, sizeof(buf) - pos < OUT_EPSIZE ? sizeof(buf) - pos : OUT_EPSIZE);
+		sim_run_ms(TX_FILL_TIMEOUT_MS * 2 / 3);
+	}
+	check(sim_run_until(tx_all, 5000) || tx_count == 2, "slow frame not sent");
+	check(tx_count == 2 && frame_check(tx[1].data, tx[1].len, 2), "slow frame corrupt");
+
+	get_stats(&s);
+	check(s.tx_fill_timeout == 1, "%u fill timeouts", s.tx_fill_timeout);
+}
+
+/* Throughput of back to back long frames in both directions over the
+ * bulk configuration. Only the timing of the protocols is simulated,
+ * the firmware takes no time, so these are upper bounds */
+static void scenario_bench(void)
+{
+	uint32_t start, tx_ms, rx_ms, at, end, latency = 0;
+	uint16_t len = radio_frame_length(LONG_FRAME_MARKER);
+	unsigned int i;
+
+	start = sim_ms();
+	for (i = 0; i < BENCH_FRAMES; i++)
+		host_frame(2 * i + 1);
+	while (tx_count < BENCH_FRAMES && sim_ms() - start < 60000)
+		sim_run_ms(10);
+	tx_ms = tx[tx_count ? tx_count - 1 : 0].ms - start;
+	sim_run_until(tx_released, 2000);
+
+	/* Frames are not received before the PTT delay has passed */
+	sim_run_ms(conf.ptt_delay_low + 10);
+
+	check(tx_count == BENCH_FRAMES, "%u of %u frames sent", tx_count, BENCH_FRAMES);
+
+	at = start = sim_ms() + 10;
+	for (i = 0; i < BENCH_FRAMES; i++)
+		at += air_frame(2 * i + 1, at);
+	while (rx_count < BENCH_FRAMES && sim_ms() < at + 1000)
+		sim_run_ms(1);
+	rx_ms = rx[rx_count ? rx_count - 1 : 0].ms - start;
+
+	check(rx_count == BENCH_FRAMES, "%u of %u frames received", rx_count, BENCH_FRAMES);
+
+	/* Delay from the end of a frame on air to the end of its transfer */
+	for (i = 0, at = start; i < rx_count; i++) {
+		end = at + (uint32_t)(CUB_LENGTH + FSM_LENGTH + len) * BITS_PER_BYTE * 1000 / conf.bitrate;
+		if (rx[i].ms > end && rx[i].ms - end > latency)
+			latency = rx[i].ms - end;
+		at += frame_ms(len);
+	}
+
+	printf("bitrate        %u bps\n", conf.bitrate);
+	printf("tx             %u frames of %u bytes in %u ms, %u bytes on air\n",
+	       tx_count, len, tx_ms, radio_stats.tx_bytes);
+	printf("tx payload     %u bps\n", tx_ms ? (uint32_t)((uint64_t)tx_count * len * 8000 / tx_ms) : 0);
+	printf("rx             %u frames of %u bytes in %u ms\n", rx_count, len, rx_ms);
+	printf("rx payload     %u bps\n", rx_ms ? (uint32_t)((uint64_t)rx_count * len * 8000 / rx_ms) : 0);
+	printf("rx latency     %u ms max\n", latency);
+	printf("spi overruns   %u\n", radio_stats.overruns);
+}
+
+static const struct {
+	const char *name;
+	uint8_t configuration;
+	void (*run)(void);
+} scenarios[] = {
+	{"rx", INTERRUPT_CONFIGURATION, scenario_rx},
+	{"rx_bulk", BULK_CONFIGURATION, scenario_rx},
+	{"rx_stall", INTERRUPT_CONFIGURATION, scenario_rx_stall},
+	{"tx", INTERRUPT_CONFIGURATION, scenario_tx},
+	{"tx_bulk", BULK_CONFIGURATION, scenario_tx},
+	{"tx_reconf", INTERRUPT_CONFIGURATION, scenario_tx_reconf},
+	{"tx_stall", INTERRUPT_CONFIGURATION, scenario_tx_stall},
+	{"bench", BULK_CONFIGURATION, scenario_bench},
+};
+
+#define SCENARIOS	(sizeof(scenarios) / sizeof(scenarios[0]))
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+
+	if (argc == 2 && !strcmp(argv[1], "list")) {
+		for (i = 0; i < SCENARIOS; i++)
+			printf("%s\n", scenarios[i].name);
+		return 0;
+	}
+
+	for (i = 0; argc == 2 && i < SCENARIOS; i++) {
+		if (strcmp(argv[1], scenarios[i].name))
+			continue;
+
+		host_configure(scenarios[i].configuration);
+		boot();
+		scenarios[i].run();
+
+		printf("%s %s\n", failures ? "FAIL" : "PASS", scenarios[i].name);
+		return failures ? 1 : 0;
+	}
+
+	fprintf(stderr, "usage: %s list|<scenario>\n", argv[0]);
+	return 2;
+}
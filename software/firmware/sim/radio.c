@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Virtual ADF7021. It decodes the bit-banged 3-wire register interface,
+ * answers readbacks, raises SWD when a queued frame starts and clocks
+ * the demodulated bytes into SPDR, or takes the bytes to send from SPDR
+ * while the transmitter is on. Only what the firmware relies on is
+ * modelled: R0 selects RX or TX and R12 rearms sync word detection */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <avr/io.h>
+
+#include "bluebox.h"
+#include "adf7021.h"
+#include "sim.h"
+#include "radio.h"
+
+#define RADIO_QUEUE		64
+#define RADIO_AIR_MAX		(CALLSIGN_LENGTH + FSM_LENGTH + DATA_LENGTH)
+
+struct radio_frame {
+	uint64_t start;
+	uint16_t len;
+	uint8_t air[RADIO_AIR_MAX];
+};
+
+struct radio_stats radio_stats;
+
+/* Register interface */
+static uint8_t prev_sclk, prev_sle;
+static uint32_t shift;
+static uint8_t shift_bits;
+static uint32_t regs[16];
+static uint8_t last_addr = 0xFF;
+static uint32_t readback;
+static uint8_t readback_bits;
+static int16_t rssi_dbm = -110;
+
+/* Demodulator and modulator */
+static bool tx_on;
+static bool swd_armed;
+static struct radio_frame queue[RADIO_QUEUE];
+static uint8_t queue_head, queue_tail;
+static const struct radio_frame *air;
+static uint64_t air_start;
+static uint64_t byte_next = SIM_NEVER;
+
+/* Decoder for the transmitted stream */
+#define DEC_HUNT		0
+#define DEC_FSM			1
+#define DEC_DATA		2
+
+static struct {
+	uint8_t state;
+	uint8_t window[CALLSIGN_LENGTH];
+	uint16_t training;
+	uint16_t len;
+	uint16_t pos;
+	uint8_t data[DATA_LENGTH];
+} dec;
+
+static radio_tx_handler tx_handler;
+
+void radio_init(void)
+{
+	memset(&radio_stats, 0, sizeof(radio_stats));
+}
+
+void radio_set_rssi(int16_t dbm)
+{
+	rssi_dbm = dbm;
+}
+
+void radio_on_tx(radio_tx_handler handler)
+{
+	tx_handler = handler;
+}
+
+bool radio_tx_on(void)
+{
+	return tx_on;
+}
+
+bool radio_send(const uint8_t *data, uint16_t len, uint32_t at_ms)
+{
+	struct radio_frame *frame;
+
+	if ((uint8_t)(queue_head - queue_tail) >= RADIO_QUEUE || len > RADIO_AIR_MAX)
+		return false;
+
+	frame = &queue[queue_head++ % RADIO_QUEUE];
+	frame->start = (uint64_t)at_ms * SIM_CYCLES_PER_MS;
+	frame->len = len;
+	memcpy(frame->air, data, len);
+
+	return true;
+}
+
+uint8_t radio_queued(void)
+{
+	return queue_head - queue_tail;
+}
+
+/* Length of the coded frame for a frame sync marker, as the receiver
+ * would decide it */
+uint16_t radio_frame_length(uint8_t fsm)
+{
+	uint8_t diff_short = __builtin_popcount(fsm ^ SHORT_FRAME_MARKER);
+	uint8_t diff_long = __builtin_popcount(fsm ^ LONG_FRAME_MARKER);
+	uint16_t bytes = CSP_OVERHEAD;
+
+	bytes += (diff_short < diff_long) ? SHORT_FRAME_LIMIT : LONG_FRAME_LIMIT;
+	if (conf.do_rs)
+		bytes += RS_LENGTH;
+	if (conf.do_viterbi)
+		bytes = (bytes + VITERBI_TAIL) * VITERBI_RATE;
+
+	return bytes;
+}
+
+static uint32_t radio_readback(uint8_t select)
+{
+	switch (select) {
+	case ADF_READBACK_RSSI:
+		/* Gain code 10 has no correction */
+		return ((rssi_dbm + 130) * 2 & 0x7F) | (10 << 7);
+	case ADF_READBACK_AFC:
+		/* No frequency error */
+		return 100000 / (XTAL_FREQ >> 18);
+	case ADF_READBACK_VERSION:
+		return 0x2104;
+	default:
+		return 0;
+	}
+}
+
+static void radio_latch(uint32_t value)
+{
+	uint8_t addr = value & 0x0F;
+	bool tx;
+
+	regs[addr] = value;
+	last_addr = addr;
+
+	switch (addr) {
+	case 0:
+		tx = !(value & (1UL << 27));
+		if (tx && !tx_on)
+			radio_stats.keyups++;
+		if (tx != tx_on)
+			memset(&dec, 0, sizeof(dec));
+		tx_on = tx;
+		break;
+	case 5:
+		radio_stats.if_cals++;
+		break;
+	case 12:
+		swd_armed = true;
+		break;
+	}
+}
+
+void radio_pins(void)
+{
+	uint8_t sclk = !!(ADF_PORT_SCLK & _BV(ADF_SCLK));
+	uint8_t sle = !!(ADF_PORT_SLE & _BV(ADF_SLE));
+	uint8_t sdata = !!(ADF_PORT_SDATA & _BV(ADF_SDATA));
+
+	if (sle && !prev_sle) {
+		/* A full word latches a register. Raising LE again right
+		 * after an R7 write starts the readback */
+		if (shift_bits == 32)
+			radio_latch(shift);
+		else if (shift_bits == 0 && last_addr == 7)
+			readback_bits = 17;
+		else if (shift_bits)
+			radio_stats.bad_writes++;
+		readback = radio_readback((regs[7] >> 4) & 0x1F);
+		shift_bits = 0;
+	}
+
+	if (sclk && !prev_sclk) {
+		if (sle) {
+			/* DB16 is clocked out first, then DB15 to DB0 */
+			if (readback_bits) {
+				readback_bits--;
+				if (readback & (1UL << readback_bits))
+					ADF_PORT_IN_SREAD |= _BV(ADF_SREAD);
+				else
+					ADF_PORT_IN_SREAD &= ~_BV(ADF_SREAD);
+			}
+		} else {
+			shift = (shift << 1) | sdata;
+			if (shift_bits <= 32)
+				shift_bits++;
+		}
+	}
+
+	if (!sle)
+		readback_bits = 0;
+
+	prev_sclk = sclk;
+	prev_sle = sle;
+}
+
+static uint64_t radio_byte_cycles(void)
+{
+	return (uint64_t)8 * F_CPU / conf.bitrate;
+}
+
+static bool radio_spi_on(void)
+{
+	return (sim_io[SIM_SPCR] & _BV(SPE));
+}
+
+uint64_t radio_next_event(void)
+{
+	uint64_t next = SIM_NEVER;
+
+	if (queue_head != queue_tail)
+		next = queue[queue_tail % RADIO_QUEUE].start;
+
+	if (radio_spi_on()) {
+		/* The data clock keeps running while SPI is off, in step
+		 * with the last frame */
+		if (byte_next == SIM_NEVER || byte_next < sim_cycles)
+			byte_next = sim_cycles + radio_byte_cycles() -
+				    (sim_cycles - air_start) % radio_byte_cycles();
+		if (byte_next < next)
+			next = byte_next;
+	}
+
+	return next;
+}
+
+/* A frame starts on air. The sync word is only detected in RX and
+ * once R12 has been written since the last detection */
+static void radio_frame_start(void)
+{
+	const struct radio_frame *frame = &queue[queue_tail++ % RADIO_QUEUE];
+
+	if (tx_on || !swd_armed) {
+		radio_stats.missed++;
+		return;
+	}
+
+	swd_armed = false;
+	air = frame;
+	air_start = sim_cycles;
+	byte_next = sim_cycles + radio_byte_cycles();
+	radio_stats.synced++;
+
+	/* SWD rising edge */
+#if defined(BBSTANDARD)
+	sim_io[SIM_EIFR] |= _BV(INTF6);
+#elif defined(BBMICRO)
+	if (sim_io[SIM_PCMSK0] & _BV(PCINT5))
+		sim_io[SIM_PCIFR] |= _BV(PCIF0);
+#endif
+}
+
+static void radio_decode(uint8_t byte)
+{
+	switch (dec.state) {
+	case DEC_HUNT:
+		if (byte == conf.training_symbol)
+			dec.training++;
+		memmove(dec.window, dec.window + 1, CALLSIGN_LENGTH - 1);
+		dec.window[CALLSIGN_LENGTH - 1] = byte;
+		if (!memcmp(dec.window, conf.callsign, CALLSIGN_LENGTH))
+			dec.state = DEC_FSM;
+		break;
+	case DEC_FSM:
+		dec.len = radio_frame_length(byte);
+		dec.pos = 0;
+		dec.state = DEC_DATA;
+		break;
+	case DEC_DATA:
+		dec.data[dec.pos++] = byte;
+		if (dec.pos < dec.len)
+			break;
+		radio_stats.sent++;
+		if (tx_handler)
+			tx_handler(dec.data, dec.len, dec.training);
+		memset(&dec, 0, sizeof(dec));
+		break;
+	}
+}
+
+static void radio_byte(void)
+{
+	uint64_t pos;
+
+	byte_next += radio_byte_cycles();
+
+	if (!radio_spi_on())
+		return;
+
+	/* The previous byte was never picked up */
+	if (sim_io[SIM_SPSR] & _BV(SPIF))
+		radio_stats.overruns++;
+
+	if (tx_on) {
+		radio_stats.tx_bytes++;
+		radio_decode(sim_io[SIM_SPDR]);
+	} else if (air && (pos = (sim_cycles - air_start) / radio_byte_cycles()) <= air->len) {
+		/* The frame goes on whether or not the bytes are read */
+		sim_io[SIM_SPDR] = air->air[pos - 1];
+	} else {
+		sim_io[SIM_SPDR] = 0x00;
+	}
+
+	sim_io[SIM_SPSR] |= _BV(SPIF);
+}
+
+void radio_event(void)
+{
+	if (queue_head != queue_tail && queue[queue_tail % RADIO_QUEUE].start <= sim_cycles)
+		radio_frame_start();
+	else
+		radio_byte();
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _SIM_RADIO_H_
+#define _SIM_RADIO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct radio_stats {
+	uint32_t keyups;	/* Switches from RX to TX */
+	uint32_t synced;	/* Frames whose sync word was detected */
+	uint32_t missed;	/* Frames on air while not listening */
+	uint32_t sent;		/* Frames decoded from the TX stream */
+	uint32_t tx_bytes;	/* Bytes clocked out while transmitting */
+	uint32_t overruns;	/* SPI bytes not serviced in time */
+	uint32_t bad_writes;	/* Register writes that were not 32 bits */
+	uint32_t if_cals;	/* R5 writes, each starts an IF filter calibration */
+};
+
+extern struct radio_stats radio_stats;
+
+/* Called for each frame found in the transmitted stream, with the
+ * number of training symbols sent before it */
+typedef void (*radio_tx_handler)(const uint8_t *data, uint16_t len, uint16_t training);
+
+/* Put a frame on air at at_ms. data is what follows the sync word:
+ * the rest of the callsign, the frame sync marker and the coded frame */
+bool radio_send(const uint8_t *data, uint16_t len, uint32_t at_ms);
+uint8_t radio_queued(void);
+uint16_t radio_frame_length(uint8_t fsm);
+void radio_set_rssi(int16_t dbm);
+void radio_on_tx(radio_tx_handler handler);
+bool radio_tx_on(void);
+
+#endif /* _SIM_RADIO_H_ */
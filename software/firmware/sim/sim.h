@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Simulated time in CPU cycles since reset */
+extern uint64_t sim_cycles;
+
+#define SIM_CYCLES_PER_MS	(F_CPU / 1000)
+#define SIM_NEVER		UINT64_MAX
+
+static inline uint32_t sim_ms(void)
+{
+	return sim_cycles / SIM_CYCLES_PER_MS;
+}
+
+/* Start the firmware and let it run for ms of simulated time. The
+ * firmware only stops when it goes to sleep, so the test scenario runs
+ * between two main loop iterations, like an interrupt would */
+void sim_run_ms(uint32_t ms);
+
+/* Run until done() returns true or timeout_ms has passed. Returns true
+ * if done() did */
+bool sim_run_until(bool (*done)(void), uint32_t timeout_ms);
+
+/* Interrupt flags are set in the register file. Pending and enabled
+ * interrupts are dispatched whenever interrupts are enabled */
+void sim_dispatch(void);
+
+/* Virtual ADF7021 in radio.c */
+void radio_init(void);
+void radio_pins(void);
+uint64_t radio_next_event(void);
+void radio_event(void);
+
+/* Virtual USB host in usb.c, polled once per millisecond */
+void usb_tick(void);
+
+#endif /* _SIM_H_ */
@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Simulated USB controller and host. The device side implements the
+ * LUFA endpoint calls the firmware uses on single banked data
+ * endpoints. The host moves at most one packet per millisecond in each
+ * direction in the interrupt configuration, and up to 19 in the bulk
+ * configuration, which is the full speed limit */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bluebox.h"
+#include "Descriptors.h"
+#include "sim.h"
+#include "host.h"
+
+#define HOST_PACKETS		4096
+#define HOST_TRANSFER_MAX	1024
+
+#define INTERRUPT_PACKETS_PER_MS	1
+#define BULK_PACKETS_PER_MS		19
+
+USB_Request_Header_t USB_ControlRequest;
+volatile uint8_t USB_DeviceState = DEVICE_STATE_Unattached;
+uint8_t USB_Device_ConfigurationNumber;
+
+static uint8_t configuration = INTERRUPT_CONFIGURATION;
+static uint8_t selected;
+
+/* Endpoint banks */
+static struct {
+	uint8_t data[IN_EPSIZE];
+	uint8_t len;
+	uint8_t pos;
+	bool full;
+} out_ep;
+
+static struct {
+	uint8_t data[IN_EPSIZE];
+	uint8_t len;
+	bool busy;
+} in_ep;
+
+/* Host side */
+static struct {
+	uint8_t len;
+	uint8_t data[OUT_EPSIZE];
+} out_packets[HOST_PACKETS];
+static uint16_t out_head, out_tail;
+
+static uint8_t out_budget, in_budget;
+static bool reading = true;
+static uint8_t transfer[HOST_TRANSFER_MAX];
+static uint16_t transfer_len;
+static host_in_handler in_handler;
+
+/* Control request data stage */
+static struct {
+	const uint8_t *out;
+	uint8_t *in;
+	uint16_t len;
+	uint16_t done;
+	bool stalled;
+} ctrl;
+
+static uint8_t packets_per_ms(void)
+{
+	return configuration == BULK_CONFIGURATION ? BULK_PACKETS_PER_MS : INTERRUPT_PACKETS_PER_MS;
+}
+
+static uint8_t out_epsize(void)
+{
+	return configuration == BULK_CONFIGURATION ? BULK_OUT_EPSIZE : OUT_EPSIZE;
+}
+
+static void host_fill_out(void)
+{
+	if (out_ep.full || !out_budget || out_head == out_tail)
+		return;
+
+	out_ep.len = out_packets[out_tail % HOST_PACKETS].len;
+	memcpy(out_ep.data, out_packets[out_tail % HOST_PACKETS].data, out_ep.len);
+	out_ep.pos = 0;
+	out_ep.full = true;
+	out_tail++;
+	out_budget--;
+}
+
+static void host_take_in(void)
+{
+	if (!in_ep.busy || !reading || !in_budget)
+		return;
+
+	if (transfer_len + in_ep.len <= sizeof(transfer)) {
+		memcpy(&transfer[transfer_len], in_ep.data, in_ep.len);
+		transfer_len += in_ep.len;
+	}
+
+	/* A short packet ends the transfer */
+	if (in_ep.len < data_in_epsize()) {
+		if (in_handler)
+			in_handler(transfer, transfer_len);
+		transfer_len = 0;
+	}
+
+	in_ep.len = 0;
+	in_ep.busy = false;
+	in_budget--;
+}
+
+void usb_tick(void)
+{
+	out_budget = in_budget = packets_per_ms();
+	host_fill_out();
+	host_take_in();
+}
+
+void host_configure(uint8_t config)
+{
+	configuration = config;
+}
+
+bool host_send_bytes(const uint8_t *data, uint16_t len)
+{
+	uint8_t size = out_epsize();
+	uint8_t n;
+
+	if ((len + size - 1) / size > HOST_PACKETS - host_out_pending())
+		return false;
+
+	do {
+		n = len < size ? len : size;
+		out_packets[out_head % HOST_PACKETS].len = n;
+		memcpy(out_packets[out_head % HOST_PACKETS].data, data, n);
+		out_head++;
+		data += n;
+		len -= n;
+	} while (len);
+
+	return true;
+}
+
+bool host_send_frame(const uint8_t *data, uint16_t size)
+{
+	uint8_t buf[TOTAL_LENGTH];
+	struct tx_header *hdr = (struct tx_header *)buf;
+
+	if (size > TOTAL_LENGTH - sizeof(*hdr))
+		return false;
+
+	memset(buf, 0, sizeof(buf));
+	hdr->size = size;
+	memcpy(buf + sizeof(*hdr), data, size);
+
+	return host_send_bytes(buf, sizeof(buf));
+}
+
+uint16_t host_out_pending(void)
+{
+	return out_head - out_tail;
+}
+
+void host_read(bool enabled)
+{
+	reading = enabled;
+}
+
+void host_on_in(host_in_handler handler)
+{
+	in_handler = handler;
+}
+
+/* The request is handled like the USB_COM interrupt does, on the
+ * control endpoint with interrupts enabled */
+static uint16_t host_control(uint8_t dir, uint8_t request, uint16_t value, uint16_t len)
+{
+	uint8_t prev = selected;
+
+	USB_ControlRequest.bmRequestType = dir | REQTYPE_CLASS | REQREC_INTERFACE;
+	USB_ControlRequest.bRequest = request;
+	USB_ControlRequest.wValue = value;
+	USB_ControlRequest.wIndex = 0;
+	USB_ControlRequest.wLength = len;
+	ctrl.len = len;
+	ctrl.done = 0;
+	ctrl.stalled = false;
+
+	selected = 0;
+	EVENT_USB_Device_ControlRequest();
+	selected = prev;
+
+	return ctrl.stalled ? HOST_CONTROL_STALLED : ctrl.done;
+}
+
+uint16_t host_control_out(uint8_t request, uint16_t value, const void *data, uint16_t len)
+{
+	ctrl.out = data;
+	ctrl.in = NULL;
+
+	return host_control(REQDIR_HOSTTODEVICE, request, value, len);
+}
+
+uint16_t host_control_in(uint8_t request, uint16_t value, void *data, uint16_t len)
+{
+	ctrl.out = NULL;
+	ctrl.in = data;
+
+	return host_control(REQDIR_DEVICETOHOST, request, value, len);
+}
+
+void USB_Init(void)
+{
+	USB_DeviceState = DEVICE_STATE_Configured;
+	USB_Device_ConfigurationNumber = configuration;
+}
+
+void Endpoint_SelectEndpoint(uint8_t address)
+{
+	selected = address;
+}
+
+bool Endpoint_IsINReady(void)
+{
+	return selected == IN_EPADDR && !in_ep.busy;
+}
+
+bool Endpoint_IsOUTReceived(void)
+{
+	return selected == OUT_EPADDR && out_ep.full;
+}
+
+bool Endpoint_IsReadWriteAllowed(void)
+{
+	if (selected == OUT_EPADDR)
+		return out_ep.full && out_ep.pos < out_ep.len;
+	if (selected == IN_EPADDR)
+		return !in_ep.busy && in_ep.len < data_in_epsize();
+
+	return false;
+}
+
+uint16_t Endpoint_BytesInEndpoint(void)
+{
+	if (selected == OUT_EPADDR)
+		return out_ep.full ? out_ep.len - out_ep.pos : 0;
+	if (selected == IN_EPADDR)
+		return in_ep.len;
+
+	return 0;
+}
+
+void Endpoint_ClearIN(void)
+{
+	if (selected != IN_EPADDR)
+		return;
+
+	in_ep.busy = true;
+	host_take_in();
+}
+
+void Endpoint_ClearOUT(void)
+{
+	if (selected != OUT_EPADDR)
+		return;
+
+	out_ep.full = false;
+	host_fill_out();
+}
+
+void Endpoint_ClearSETUP(void)
+{
+}
+
+/* LUFA waits up to USB_STREAM_TIMEOUT_MS here. The firmware only starts
+ * a stream once the endpoint is ready, so this never waits */
+static uint8_t Endpoint_WaitUntilReady(void)
+{
+	if (selected == OUT_EPADDR ? out_ep.full : !in_ep.busy)
+		return ENDPOINT_RWSTREAM_NoError;
+
+	return ENDPOINT_RWSTREAM_Timeout;
+}
+
+uint8_t Endpoint_Read_Stream_LE(void *buffer, uint16_t length, uint16_t *processed)
+{
+	uint8_t *data = buffer;
+	uint16_t transferred = 0;
+	uint8_t err;
+
+	if ((err = Endpoint_WaitUntilReady()))
+		return err;
+
+	if (processed) {
+		length -= *processed;
+		if (data)
+			data += *processed;
+	}
+
+	while (length) {
+		if (!Endpoint_IsReadWriteAllowed()) {
+			Endpoint_ClearOUT();
+			if (processed) {
+				*processed += transferred;
+				return ENDPOINT_RWSTREAM_IncompleteTransfer;
+			}
+			if ((err = Endpoint_WaitUntilReady()))
+				return err;
+		} else {
+			if (data)
+				*data++ = out_ep.data[out_ep.pos];
+			out_ep.pos++;
+			length--;
+			transferred++;
+		}
+	}
+
+	return ENDPOINT_RWSTREAM_NoError;
+}
+
+uint8_t Endpoint_Discard_Stream(uint16_t length, uint16_t *processed)
+{
+	return Endpoint_Read_Stream_LE(NULL, length, processed);
+}
+
+uint8_t Endpoint_Write_Stream_LE(const void *buffer, uint16_t length, uint16_t *processed)
+{
+	const uint8_t *data = buffer;
+	uint16_t transferred = 0;
+	uint8_t err;
+
+	if ((err = Endpoint_WaitUntilReady()))
+		return err;
+
+	if (processed) {
+		length -= *processed;
+		data += *processed;
+	}
+
+	while (length) {
+		if (!Endpoint_IsReadWriteAllowed()) {
+			Endpoint_ClearIN();
+			if (processed) {
+				*processed += transferred;
+				return ENDPOINT_RWSTREAM_IncompleteTransfer;
+			}
+			if ((err = Endpoint_WaitUntilReady()))
+				return err;
+		} else {
+			in_ep.data[in_ep.len++] = *data++;
+			length--;
+			transferred++;
+		}
+	}
+
+	return ENDPOINT_RWSTREAM_NoError;
+}
+
+void Endpoint_StallTransaction(void)
+{
+	ctrl.stalled = true;
+}
+
+uint8_t Endpoint_Read_Control_Stream_LE(void *buffer, uint16_t length)
+{
+	if (length > ctrl.len)
+		length = ctrl.len;
+	if (ctrl.out)
+		memcpy(buffer, ctrl.out, length);
+	ctrl.done = length;
+
+	return ENDPOINT_RWCSTREAM_NoError;
+}
+
+uint8_t Endpoint_Write_Control_Stream_LE(const void *buffer, uint16_t length)
+{
+	if (length > ctrl.len)
+		length = ctrl.len;
+	if (ctrl.in)
+		memcpy(ctrl.in, buffer, length);
+	ctrl.done = length;
+
+	return ENDPOINT_RWCSTREAM_NoError;
+}
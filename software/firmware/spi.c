@@ -24,28 +24,151 @@
 #include <string.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 
 #include "adf7021.h"
 #include "bluebox.h"
 #include "spi.h"
 #include "led.h"
+#include "ptt.h"
+#include "timer.h"
+#include "stats.h"
+#include "profile.h"
+#include "sched.h"
+
+/* Frame ring, or the byte ring in raw mode */
+static union {
+	struct data_buffer frames[RX_RING_SIZE];
+	uint8_t raw[RAW_RING_SIZE];
+} rx_store;
+#if !defined(TX_SHARES_RX_RING)
+static struct tx_buffer tx_queue[TX_QUEUE_SIZE];
+#endif
 
-struct data_buffer data[NUM_BUFS];
-uint8_t front = 0;
-uint8_t back  = 1;
+/* RX ring indices. rx_head is only advanced by the SPI ISR when a frame
+ * is complete and rx_tail only by rx_task() when a frame has been
+ * delivered, so the ring never needs locking. The indices are free
+ * running and masked on access. */
+static volatile uint8_t rx_head = 0;
+static volatile uint8_t rx_tail = 0;
+static uint16_t rx_seq = 0;
+
+/* TX queue indices. tx_head is only advanced by spi_tx_queue() and
+ * tx_tail only by the SPI ISR when a frame has been sent. */
+static volatile uint8_t tx_head = 0;
+static volatile uint8_t tx_tail = 0;
+
+/* Raw mode ring indices, free running like the frame ring. While
+ * raw_lost is nonzero the ISR drops every byte, so the gap stays at
+ * raw_head until rx_task() has sent everything before it. */
+static volatile uint16_t raw_head = 0;
+static volatile uint16_t raw_tail = 0;
+static volatile uint32_t raw_lost = 0;
+static uint32_t raw_offset;
+static uint32_t raw_sent_ms;
+static uint16_t raw_seq;
+static bool raw_gap;
+static volatile bool raw_stop;
+
+/* Ring position where a new configuration took effect in raw mode */
+static uint16_t raw_mark;
+static bool raw_marked;
+
+/* Buffer currently used by the ISR when receiving */
+static struct data_buffer *front = &rx_store.frames[0];
+
+/* Frame currently being sent by the ISR */
+static struct tx_buffer *tx_front;
+static volatile bool tx_active = false;
+
+/* A TX frame goes out as segments of training symbols, callsign and FSM,
+ * and frame data. tx_ptr advances by tx_step, which is 0 while repeating
+ * the training symbol. tx_next is fetched one interrupt ahead, so the
+ * ISR can load it into SPDR before anything else. */
+#define TX_SEGMENT_TRAINING	0
+#define TX_SEGMENT_PREAMBLE	1
+#define TX_SEGMENT_DATA		2
+#define TX_SEGMENT_END		3
+
+static const uint8_t *tx_ptr;
+static uint16_t tx_left;
+static uint8_t tx_step;
+static uint8_t tx_segment;
+static uint8_t tx_next;
+
+/* Training symbols left to send while waiting for frame data */
+static uint16_t tx_stretch_left;
+
+/* RX frame state. The ISR only acts when rx_left reaches zero: after the
+ * CUB, after the FSM and at the end of the frame */
+#define RX_STAGE_CUB		0
+#define RX_STAGE_FSM		1
+#define RX_STAGE_DATA		2
+
+static uint8_t *rx_ptr;
+static uint16_t rx_left;
+static uint8_t rx_stage;
+
+/* Frame waiting for its RSSI and AFC readback */
+static struct data_buffer *volatile readback_buf = NULL;
+
+/* Set while tx_task() is reading a frame into a buffer from spi_tx_prepare() */
+static volatile bool tx_reserved = false;
+
+/* Set once a frame has gone out and the PTT is still keyed, so the next
+ * frame only needs the inter-frame training sequence */
+static volatile bool tx_burst = false;
+
+/* Set when the PTT was released with frames still queued or reserved, so
+ * a staged configuration could take effect. spi_mode stays TX */
+static volatile bool tx_paused = false;
 
 static volatile unsigned char spi_mode = SPI_MODE_IDLE;
-static char preamble[CALLSIGN_LENGTH + FSM_LENGTH];
+static uint8_t preamble[CALLSIGN_LENGTH + FSM_LENGTH];
 
-static inline uint8_t __attribute__ ((pure)) popcount(uint8_t num)
+/* Set bits in a nibble */
+static const uint8_t nibble_bits[16] PROGMEM = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+static inline struct data_buffer *rx_ring_slot(uint8_t index)
+{
+	return &rx_store.frames[index & RX_RING_MASK];
+}
+
+static inline uint8_t rx_ring_free(void)
+{
+	return RX_RING_SIZE - (uint8_t)(rx_head - rx_tail);
+}
+
+#if defined(TX_SHARES_RX_RING)
+/* The frame is sent from the free RX slot at rx_head. No reception can
+ * start while there is a frame to send, so the slot stays the same. The
+ * build uses -fno-strict-aliasing, and a tx_buffer is the smaller one */
+static inline struct tx_buffer *tx_queue_slot(uint8_t index)
+{
+	return (struct tx_buffer *)rx_ring_slot(rx_head);
+}
+#else
+static inline struct tx_buffer *tx_queue_slot(uint8_t index)
+{
+	return &tx_queue[index & TX_QUEUE_MASK];
+}
+#endif
+
+/* A burst is broken up while a staged configuration waits for a gap */
+static inline bool tx_hold(void)
 {
-	uint8_t count;
+	return (conf.flags & CONF_FLAG_RECONFIGURE);
+}
 
-	/* Clear the least significant bit set */
-	for (count = 0; num; count++)
-		num &= num - 1; 
+static inline uint8_t tx_queue_free(void)
+{
+	return TX_QUEUE_SIZE - (uint8_t)(tx_head - tx_tail);
+}
 
-	return count;
+static inline uint8_t __attribute__ ((pure)) popcount(uint8_t num)
+{
+	/* Constant time, this runs in the SPI ISR */
+	return pgm_read_byte(&nibble_bits[num & 0x0f]) + pgm_read_byte(&nibble_bits[num >> 4]);
 }
 
 static inline uint8_t __attribute__ ((pure)) frame_type(uint8_t fsm)
@@ -100,15 +223,37 @@ static inline __attribute__ ((pure)) int tx_frame_fsm(int data)
 	return (data <= short_frame_limit) ? SHORT_FRAME_MARKER : LONG_FRAME_MARKER;
 }
 
-void spi_rx_start(void)
+void spi_rx_start(uint32_t timestamp)
 {
+	/* Drop the frame if the host has not picked up the ring */
+	if (!rx_ring_free()) {
+		stats.rx_overflow++;
+		rx_seq++;
+		adf_set_threshold_free();
+		return;
+	}
+
 	spi_mode = SPI_MODE_RX;
 	swd_disable();
 
 	led_on(LED_RECEIVE);
 
-	data[front].progress = 0;
-	data[front].size = DATA_LENGTH;
+	front = rx_ring_slot(rx_head);
+	front->flags = FLAG_NO_READBACK;
+	front->rssi = 0;
+	front->freq = 0;
+	front->fsm_distance = 0;
+	front->progress = 0;
+	front->size = DATA_LENGTH;
+	front->timestamp = timestamp;
+
+	rx_ptr = front->data;
+	rx_left = FSM_POSITION;
+	rx_stage = RX_STAGE_CUB;
+
+	/* The carrier is up once the sync word matched */
+	readback_buf = front;
+	sched_post(EVENT_RX);
 
 	spi_enable();
 	spi_enable_it();
@@ -120,57 +265,227 @@ void spi_rx_done(void)
 	spi_disable();
 	swd_enable();
 
+	/* Too late for a readback, the carrier is gone */
+	readback_buf = NULL;
+
 	led_off(LED_RECEIVE);
 	spi_mode = SPI_MODE_IDLE;
 }
 
-void spi_tx_start(void)
+/* Select the segment after tx_segment, may be empty */
+static inline void tx_segment_load(void)
+{
+	switch (++tx_segment) {
+	case TX_SEGMENT_PREAMBLE:
+		tx_ptr = preamble;
+		tx_left = sizeof(preamble);
+		tx_step = 1;
+		break;
+	case TX_SEGMENT_DATA:
+		tx_ptr = tx_front->data;
+		tx_left = tx_front->size;
+		break;
+	}
+}
+
+/* Next byte to send. Once the frame is done this is a training symbol,
+ * which is never fully shifted out */
+static inline uint8_t tx_fetch(void)
+{
+	uint8_t byte;
+
+	while (!tx_left) {
+		if (tx_segment == TX_SEGMENT_TRAINING && tx_front->state != TX_BUFFER_READY) {
+			/* Keep training until the host has sent the whole frame,
+			 * or skip it if the transfer failed or takes too long */
+			if (tx_front->state == TX_BUFFER_FILLING && tx_stretch_left) {
+				tx_stretch_left--;
+				stats.tx_training_stretch++;
+			} else {
+				tx_segment = TX_SEGMENT_END;
+			}
+			return conf.training_symbol;
+		}
+		if (tx_segment >= TX_SEGMENT_DATA) {
+			tx_segment = TX_SEGMENT_END;
+			return conf.training_symbol;
+		}
+		tx_segment_load();
+	}
+
+	byte = *tx_ptr;
+	tx_ptr += tx_step;
+	tx_left--;
+
+	return byte;
+}
+
+void spi_tx_start(uint16_t training_ms)
 {
 	spi_mode = SPI_MODE_TX;
 	swd_disable();
 
-	strncpy(preamble, conf.callsign, CALLSIGN_LENGTH);
-	preamble[CALLSIGN_LENGTH] = tx_frame_fsm(data[front].size);
+	tx_front = tx_queue_slot(tx_tail);
+	tx_active = true;
+
+	memcpy(preamble, conf.callsign, CALLSIGN_LENGTH);
+	preamble[CALLSIGN_LENGTH] = tx_frame_fsm(tx_front->size);
+
+	tx_segment = TX_SEGMENT_TRAINING;
+	tx_ptr = &conf.training_symbol;
+	tx_step = 0;
+	tx_left = training_ms_to_bytes(training_ms, conf.bitrate);
+	tx_stretch_left = training_ms_to_bytes(TX_STRETCH_MS, conf.bitrate);
+	tx_next = tx_fetch();
 
-	data[front].progress = 0;
-	data[front].training = training_ms_to_bytes(conf.training_ms, conf.bitrate);
-	
 	spi_enable();
 	spi_enable_it();
 }
 
+static void spi_tx_keyed(void)
+{
+	adf_set_tx_mode();
+	spi_tx_start(conf.training_ms);
+}
+
+static void spi_tx_released(void)
+{
+	/* Frames are waiting for conf_task() or the host */
+	if (tx_head != tx_tail || tx_reserved) {
+		tx_paused = true;
+		return;
+	}
+
+	tx_paused = false;
+	swd_enable();
+	spi_mode = SPI_MODE_IDLE;
+}
+
 void spi_tx_done(void)
 {
-	data[front].flags &= ~FLAG_TX_READY;
+	tx_active = false;
 	spi_disable_it();
 	spi_disable();
-	swd_enable();
 
-	spi_mode = SPI_MODE_IDLE;
+	/* Stay keyed if the next frame is still arriving */
+	tx_burst = tx_reserved && !tx_hold();
+	if (tx_burst)
+		return;
+
+	/* SWD is enabled again once the PTT sequence is back in RX */
+	adf_set_rx_mode();
+	ptt_release(spi_tx_released);
 }
 
-bool spi_tx_prepare(void)
+/* Returns the next free TX slot, or NULL if the queue is full or a frame
+ * is being received. SWD stays disabled until the frame has been queued
+ * and sent, so no reception can start in between. */
+struct tx_buffer *spi_tx_prepare(void)
 {
-	bool allow = false;
+	struct tx_buffer *buf = NULL;
 
 	cli();
 
-	/* Do not allow TX if we're receiving a frame */
-	if (spi_mode == SPI_MODE_RX)
+	/* Do not allow TX if we're receiving a frame or in raw mode */
+	if (spi_mode == SPI_MODE_RX || spi_mode == SPI_MODE_RAW)
 		goto out;
 
-	/* Do not allow TX if we're transmitting a frame
-	 * and already have a new frame queued up */
-	if ((spi_mode == SPI_MODE_TX) && (data[back].flags & FLAG_TX_READY))
+	if (!tx_queue_free())
 		goto out;
 
+#if defined(TX_SHARES_RX_RING)
+	if (!rx_ring_free())
+		goto out;
+#endif
+
+	buf = tx_queue_slot(tx_head);
 	swd_disable();
 	spi_mode = SPI_MODE_TX;
-	allow = true;
+	tx_reserved = true;
 
 out:
 	sei();
-	return allow;
+	return buf;
+}
+
+void spi_tx_queue(struct tx_buffer *buf)
+{
+	cli();
+
+	tx_reserved = false;
+	tx_head++;
+
+	/* Key up unless the ISR will pick up the frame. If the previous
+	 * frame of a burst is done, the PTT is still keyed. A paused queue
+	 * is resumed by spi_reconfigured() */
+	if (!tx_active) {
+		if (tx_burst) {
+			spi_tx_start(conf.training_inter_ms);
+		} else if (!tx_paused || !tx_hold()) {
+			tx_paused = false;
+			ptt_key(spi_tx_keyed);
+		}
+	}
+
+	sei();
+}
+
+/* Another packet of a filling frame arrived, keep training for it */
+void spi_tx_progress(struct tx_buffer *buf)
+{
+	uint16_t stretch = training_ms_to_bytes(TX_STRETCH_MS, conf.bitrate);
+
+	cli();
+	if (tx_active && tx_front == buf)
+		tx_stretch_left = stretch;
+	sei();
+}
+
+/* All data of a queued frame has been read, or the transfer failed */
+void spi_tx_filled(struct tx_buffer *buf, bool complete)
+{
+	buf->state = complete ? TX_BUFFER_READY : TX_BUFFER_FAILED;
+}
+
+/* A reserved slot that was not filled, leave TX mode if nothing else
+ * is queued */
+void spi_tx_cancel(void)
+{
+	cli();
+
+	tx_reserved = false;
+	if (!tx_active && tx_head == tx_tail) {
+		if (tx_burst) {
+			tx_burst = false;
+			adf_set_rx_mode();
+			ptt_release(spi_tx_released);
+		} else {
+			spi_tx_released();
+		}
+	}
+
+	sei();
+}
+
+uint8_t spi_tx_free(void)
+{
+	uint8_t free = tx_queue_free();
+
+	/* The slot being filled is not free either */
+	if (tx_reserved)
+		free--;
+
+#if defined(TX_SHARES_RX_RING)
+	if (!rx_ring_free())
+		free = 0;
+#endif
+
+	return free;
+}
+
+uint8_t spi_rx_pending(void)
+{
+	return rx_head - rx_tail;
 }
 
 bool spi_busy(void)
@@ -178,33 +493,349 @@ bool spi_busy(void)
 	return (spi_mode != SPI_MODE_IDLE);
 }
 
-void rx_task(void)
+/* The radio can be reconfigured while nothing is on air or being
+ * received. Raw mode has no frames, the change is marked in the stream */
+bool spi_reconf_allowed(void)
 {
-	if (data[back].flags & FLAG_RX_READY) {
-		Endpoint_SelectEndpoint(IN_EPADDR);
-		Endpoint_AbortPendingIN();
-		Endpoint_Write_Stream_LE(&data[back], sizeof(data[back]), NULL);
-		Endpoint_ClearIN();
-		data[back].flags &= ~FLAG_RX_READY;
+	return (spi_mode == SPI_MODE_IDLE || spi_mode == SPI_MODE_RAW || tx_paused);
+}
+
+/* Called with interrupts disabled once conf_task() has applied a
+ * configuration. Sends the frames that were held back */
+void spi_reconfigured(void)
+{
+	if (spi_mode == SPI_MODE_RAW) {
+		raw_mark = raw_head;
+		raw_marked = true;
+	} else if (tx_paused) {
+		if (tx_head != tx_tail) {
+			tx_paused = false;
+			ptt_key(spi_tx_keyed);
+		} else if (!tx_reserved) {
+			spi_tx_released();
+		}
 	}
 }
 
-void flip_buffers(void)
+bool spi_receiving(void)
 {
-	back = front;
-	front = !front;
+	return (spi_mode == SPI_MODE_RX);
 }
 
-void flip_rx_buffers(void)
+/* Capture the demodulated stream continuously instead of frames after a
+ * sync word. Fails while a frame is in progress or still in the ring,
+ * as the raw ring overwrites it */
+bool spi_raw_start(void)
 {
-	data[front].flags |= FLAG_RX_READY;
-	flip_buffers();
+	bool started = false;
+
+	cli();
+
+	if (spi_mode != SPI_MODE_IDLE || rx_head != rx_tail)
+		goto out;
+
+	readback_buf = NULL;
+	raw_head = 0;
+	raw_tail = 0;
+	raw_lost = 0;
+	raw_offset = 0;
+	raw_seq = 0;
+	raw_gap = false;
+	raw_stop = false;
+	raw_marked = false;
+	raw_sent_ms = timer_ms();
+
+	spi_mode = SPI_MODE_RAW;
+	swd_disable();
+	led_on(LED_RECEIVE);
+
+	spi_enable();
+	spi_enable_it();
+	started = true;
+
+out:
+	sei();
+	return started;
+}
+
+/* Return to frame reception once the chunk being sent is done, unsent
+ * raw bytes are discarded */
+void spi_raw_stop(void)
+{
+	if (spi_mode == SPI_MODE_RAW)
+		raw_stop = true;
+}
+
+bool spi_raw(void)
+{
+	return (spi_mode == SPI_MODE_RAW);
+}
+
+/* The RSSI and AFC readbacks are bit-banged over the 3-wire interface and
+ * need a fair amount of math, so the ISR only flags the frame and the
+ * readback is done from the main loop while the frame is still on air. */
+static void rx_readback(void)
+{
+	struct data_buffer *buf;
+	adf_reg_t rssi, afc;
+	int16_t dbm, freq;
+
+	if (!readback_buf)
+		return;
+
+	/* The ISRs also drive the 3-wire interface. The frame may have
+	 * ended since the check, then it keeps FLAG_NO_READBACK */
+	cli();
+
+	buf = readback_buf;
+	readback_buf = NULL;
+	if (buf) {
+		rssi = adf_read_reg(ADF_READBACK_RSSI);
+		afc = adf_read_reg(ADF_READBACK_AFC);
+	}
+
+	sei();
+
+	if (!buf)
+		return;
+
+	dbm = adf_convert_rssi(rssi);
+	freq = adf_convert_afc(afc);
+
+	/* The ISR sets the other flags */
+	cli();
+	buf->rssi = dbm;
+	buf->freq = freq;
+	buf->flags &= ~FLAG_NO_READBACK;
+	sei();
+}
+
+/* Frame or raw chunk being sent on the IN endpoint. The header and data
+ * are written with LUFA's resumable streams, so rx_task() returns
+ * whenever the endpoint is busy instead of waiting for the host. The
+ * frame or raw bytes stay in their ring until the transfer is done. */
+#define IN_STAGE_IDLE		0
+#define IN_STAGE_HEADER		1
+#define IN_STAGE_DATA		2
+#define IN_STAGE_ZLP		3
+
+static struct {
+	uint8_t stage;
+	bool raw;
+	uint16_t done;
+	union {
+		struct rx_header rx;
+		struct raw_header raw;
+	} hdr;
+	uint8_t hdr_size;
+	uint8_t *data;
+	uint16_t size;
+} in_xfer;
+
+static void in_xfer_start(bool raw, uint8_t hdr_size, uint8_t *data, uint16_t size)
+{
+	in_xfer.stage = IN_STAGE_HEADER;
+	in_xfer.raw = raw;
+	in_xfer.done = 0;
+	in_xfer.hdr_size = hdr_size;
+	in_xfer.data = data;
+	in_xfer.size = size;
+}
+
+/* Continue the transfer for as long as the endpoint has room. Returns
+ * true once it is complete or has failed */
+static bool in_xfer_run(void)
+{
+	uint8_t err;
+
+	while (Endpoint_IsINReady()) {
+		switch (in_xfer.stage) {
+		case IN_STAGE_HEADER:
+			err = Endpoint_Write_Stream_LE(&in_xfer.hdr, in_xfer.hdr_size, &in_xfer.done);
+			if (err == ENDPOINT_RWSTREAM_IncompleteTransfer)
+				continue;
+			if (err != ENDPOINT_RWSTREAM_NoError)
+				goto error;
+			in_xfer.done = 0;
+			in_xfer.stage = IN_STAGE_DATA;
+			break;
+		case IN_STAGE_DATA:
+			err = Endpoint_Write_Stream_LE(in_xfer.data, in_xfer.size, &in_xfer.done);
+			if (err == ENDPOINT_RWSTREAM_IncompleteTransfer)
+				continue;
+			if (err != ENDPOINT_RWSTREAM_NoError)
+				goto error;
+			Endpoint_ClearIN();
+
+			/* Terminate with a zero length packet if the last one was full */
+			if ((in_xfer.hdr_size + in_xfer.size) % data_in_epsize())
+				return true;
+			in_xfer.stage = IN_STAGE_ZLP;
+			break;
+		case IN_STAGE_ZLP:
+			Endpoint_ClearIN();
+			return true;
+		}
+	}
+
+	return false;
+
+error:
+	stats.rx_usb_errors++;
+	Endpoint_ClearIN();
+	return true;
 }
 
-void flip_tx_buffers(void)
+/* Start sending the oldest frame in the ring */
+static bool rx_next(void)
 {
-	data[front].flags &= ~FLAG_TX_READY;
-	flip_buffers();
+	struct data_buffer *buf;
+	struct rx_header *hdr = &in_xfer.hdr.rx;
+
+	if (rx_head == rx_tail)
+		return false;
+
+	buf = rx_ring_slot(rx_tail);
+	hdr->size = buf->progress;
+	hdr->rssi = buf->rssi;
+	hdr->freq = buf->freq;
+	hdr->flags = buf->flags;
+	hdr->seq = buf->seq;
+	hdr->timestamp = buf->timestamp;
+
+	in_xfer_start(false, sizeof(*hdr), buf->data, hdr->size);
+
+	return true;
+}
+
+static void rx_sent(void)
+{
+	struct data_buffer *buf = rx_ring_slot(rx_tail);
+	struct rx_header *hdr = &in_xfer.hdr.rx;
+
+	stats_rx_frame(hdr->size, hdr->rssi, !(hdr->flags & FLAG_NO_READBACK),
+		       buf->fsm_distance, hdr->flags & FLAG_LONG_FRAME);
+
+	buf->flags &= ~FLAG_RX_READY;
+	rx_tail++;
+}
+
+/* Start sending the next raw chunk, if enough bytes are waiting */
+static bool raw_next(void)
+{
+	struct raw_header *hdr = &in_xfer.hdr.raw;
+	uint16_t head, start, size;
+	uint32_t lost;
+
+	cli();
+	head = raw_head;
+	lost = raw_lost;
+	sei();
+
+	size = head - raw_tail;
+
+	/* Everything before the gap is sent, let the ISR continue after it */
+	if (!size) {
+		if (lost) {
+			cli();
+			lost = raw_lost;
+			raw_lost = 0;
+			sei();
+			raw_offset += lost;
+			stats.raw_lost += lost;
+			raw_gap = true;
+		}
+		return false;
+	}
+
+	/* Bytes from before a reconfiguration go out in a chunk of their own */
+	if (raw_marked && raw_tail != raw_mark && size > (uint16_t)(raw_mark - raw_tail))
+		size = raw_mark - raw_tail;
+
+	if (size < RAW_CHUNK_MIN && !lost && !raw_marked &&
+	    timer_ms() - raw_sent_ms < RAW_FLUSH_MS)
+		return false;
+
+	/* Only the contiguous part, the rest goes in the next chunk */
+	start = raw_tail & RAW_RING_MASK;
+	if (size > RAW_RING_SIZE - start)
+		size = RAW_RING_SIZE - start;
+	if (size > RAW_CHUNK_MAX)
+		size = RAW_CHUNK_MAX;
+
+	hdr->size = size;
+	hdr->flags = raw_gap ? RAW_FLAG_GAP : 0;
+	if (raw_marked && raw_tail == raw_mark) {
+		hdr->flags |= RAW_FLAG_RECONF;
+		raw_marked = false;
+	}
+	hdr->seq = raw_seq++;
+	hdr->offset = raw_offset;
+
+	in_xfer_start(true, sizeof(*hdr), &rx_store.raw[start], size);
+
+	return true;
+}
+
+static void raw_sent(void)
+{
+	uint16_t size = in_xfer.hdr.raw.size;
+
+	raw_gap = false;
+	raw_offset += size;
+	raw_sent_ms = timer_ms();
+
+	cli();
+	raw_tail += size;
+	sei();
+}
+
+void rx_task(void)
+{
+	/* Complete a pending readback before the frame can be delivered */
+	rx_readback();
+
+	/* The frame or chunk is still in its ring and is sent again */
+	if (USB_DeviceState != DEVICE_STATE_Configured)
+		in_xfer.stage = IN_STAGE_IDLE;
+
+	/* Raw mode is left only between chunks, the ring is reused */
+	if (raw_stop && in_xfer.stage == IN_STAGE_IDLE) {
+		cli();
+		spi_rx_done();
+		sei();
+		raw_stop = false;
+	}
+
+	if (USB_DeviceState != DEVICE_STATE_Configured)
+		return;
+
+	if (in_xfer.stage == IN_STAGE_IDLE) {
+		if (spi_mode == SPI_MODE_RAW) {
+			if (!raw_next())
+				return;
+		} else if (!rx_next()) {
+			return;
+		}
+	}
+
+	Endpoint_SelectEndpoint(IN_EPADDR);
+	if (!in_xfer_run())
+		return;
+
+	in_xfer.stage = IN_STAGE_IDLE;
+	if (in_xfer.raw)
+		raw_sent();
+	else
+		rx_sent();
+}
+
+static void rx_ring_push(void)
+{
+	front->seq = rx_seq++;
+	front->flags |= FLAG_RX_READY;
+	rx_head++;
+	sched_post(EVENT_RX);
 }
 
 #if defined(BBSTANDARD)
@@ -213,67 +844,94 @@ ISR(INT6_vect)
 ISR(PCINT0_vect)
 #endif
 {
-	spi_rx_start();
+	profile_enter();
+
+	/* Sync word detected, stamp the frame before anything else */
+	spi_rx_start(timer_us());
+
+	profile_exit(PROFILE_SYNC);
 }
 
 ISR(SPI_STC_vect)
 {
-	static uint8_t errs, type, byte;
+	uint8_t type, byte;
 
-	if (spi_mode == SPI_MODE_TX) {
-		if (data[front].training > 0) {
-			spi_write_data(conf.training_symbol);
-			data[front].training--;
-		} else {
-			if (data[front].progress < (CALLSIGN_LENGTH + FSM_LENGTH))
-				byte = preamble[data[front].progress];
-			else
-				byte = data[front].data[data[front].progress - (CALLSIGN_LENGTH + FSM_LENGTH)];
-			data[front].progress++;
-			spi_write_data(byte);
-		}
+	profile_enter();
 
-		if (data[front].progress > (data[front].size + CALLSIGN_LENGTH + FSM_LENGTH)) {
-			conf.tx++;
-			if (data[back].flags & FLAG_TX_READY) {
-				flip_tx_buffers();
-				spi_tx_start();
+	if (spi_mode == SPI_MODE_TX) {
+		/* The slave shift register restarts on the next clock edge, so
+		 * the byte must be in SPDR before any other work is done */
+		spi_write_data(tx_next);
+		if (spi_get_colision_status())
+			stats.tx_spi_late++;
+
+		if (tx_segment == TX_SEGMENT_END) {
+			/* Last frame byte is out, the symbol just loaded is not sent */
+			if (tx_front->state == TX_BUFFER_READY) {
+				conf.tx_timestamp = timer_us();
+				conf.tx++;
+			}
+			tx_tail++;
+			if (tx_head != tx_tail && !tx_hold()) {
+				/* Continue the burst without releasing PTT */
+				spi_tx_start(conf.training_inter_ms);
 			} else {
 				spi_tx_done();
-				adf_set_rx_mode();
 			}
+			profile_exit(PROFILE_FRAME_END);
+			return;
 		}
-	} else {
-		data[front].data[data[front].progress++] = spi_read_data();
 
-		if (data[front].progress == 1) {
-			data[front].rssi = adf_readback_rssi();
-			data[front].freq = adf_readback_afc();
+		tx_next = tx_fetch();
+		profile_exit(tx_segment == TX_SEGMENT_TRAINING ? PROFILE_PREAMBLE : PROFILE_TX);
+	} else if (spi_mode == SPI_MODE_RAW) {
+		byte = spi_read_data();
+		if (!raw_lost && (uint16_t)(raw_head - raw_tail) < RAW_RING_SIZE)
+			rx_store.raw[raw_head++ & RAW_RING_MASK] = byte;
+		else
+			raw_lost++;
+		profile_exit(PROFILE_RX);
+	} else {
+		*rx_ptr++ = spi_read_data();
+		if (--rx_left) {
+			profile_exit(PROFILE_RX);
+			return;
 		}
 
-		if (data[front].size == DATA_LENGTH) {
-			if (data[front].progress == FSM_POSITION) {
-				errs = frame_cuberrs(data[front].data);
-				if (errs > SYNC_WORD_TOLERANCE * 2) {
-					spi_rx_done();
-					adf_set_threshold_free();
-					return;
-				}
-			}
-
-			if (data[front].progress == FSM_POSITION + 1) {
-				type = frame_type(data[front].data[FSM_POSITION]);
-				data[front].size = rx_frame_spi_length(type);
-				data[front].progress = 0;
+		switch (rx_stage) {
+		case RX_STAGE_CUB:
+			if (frame_cuberrs(front->data) > SYNC_WORD_TOLERANCE * 2) {
+				stats.rx_false_sync++;
+				spi_rx_done();
+				adf_set_threshold_free();
+				break;
 			}
-		}
-
-		if (data[front].progress >= data[front].size) {
+			rx_left = FSM_LENGTH;
+			rx_stage = RX_STAGE_FSM;
+			profile_exit(PROFILE_RX);
+			return;
+		case RX_STAGE_FSM:
+			type = frame_type(front->data[FSM_POSITION]);
+			front->fsm_distance = popcount(front->data[FSM_POSITION] ^ type);
+			if (type == LONG_FRAME_MARKER)
+				front->flags |= FLAG_LONG_FRAME;
+			front->size = rx_frame_spi_length(type);
+
+			/* Frame data overwrites the CUB and FSM */
+			rx_ptr = front->data;
+			rx_left = front->size;
+			rx_stage = RX_STAGE_DATA;
+			profile_exit(PROFILE_RX);
+			return;
+		case RX_STAGE_DATA:
+			front->progress = front->size;
 			conf.rx++;
 			spi_rx_done();
-			flip_rx_buffers();
+			rx_ring_push();
 			adf_set_threshold_free();
-			return;
+			break;
 		}
+
+		profile_exit(PROFILE_FRAME_END);
 	}
 }
@@ -109,6 +109,7 @@ static inline void swd_disable(void)
 #define SPI_MODE_RX               0
 #define SPI_MODE_TX               1
 #define SPI_MODE_IDLE			2
+#define SPI_MODE_RAW			3
 
 #define spi_enable()              (SPCR |=  (1<<SPE))
 #define spi_disable()             (SPCR &= ~(1<<SPE))
@@ -168,17 +169,25 @@ static inline void swd_disable(void)
 
 void vTaskFindlength(void * pvParameters);
 void spi_init(unsigned char config);
-void spi_rx_start(void);
+void spi_rx_start(uint32_t timestamp);
 void spi_rx_done(void);
-void spi_tx_start(void);
+void spi_tx_start(uint16_t training_ms);
 void spi_tx_done(void);
 int spi_tx_wait(void);
-bool spi_tx_prepare(void);
+struct tx_buffer *spi_tx_prepare(void);
+void spi_tx_queue(struct tx_buffer *buf);
+void spi_tx_progress(struct tx_buffer *buf);
+void spi_tx_filled(struct tx_buffer *buf, bool complete);
+void spi_tx_cancel(void);
+uint8_t spi_tx_free(void);
+uint8_t spi_rx_pending(void);
 bool spi_busy(void);
+bool spi_reconf_allowed(void);
+void spi_reconfigured(void);
+bool spi_receiving(void);
+bool spi_raw_start(void);
+void spi_raw_stop(void);
+bool spi_raw(void);
 void rx_task(void);
 
-extern struct data_buffer data[NUM_BUFS];
-extern uint8_t front;
-extern uint8_t back;
-
 #endif /* _SPI_H_ */
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* The micro has no SRAM to spare for the histograms and only counts */
+#if !defined(BBMICRO)
+#define STATS_HISTOGRAMS
+#endif
+
+/* RSSI histogram, bins of 2^STATS_RSSI_SHIFT dB from STATS_RSSI_MIN */
+#define STATS_RSSI_MIN		-130
+#define STATS_RSSI_BINS		16
+#define STATS_RSSI_SHIFT	3
+
+/* Frame length histogram, bins of 32 bytes */
+#define STATS_LENGTH_BINS	8
+#define STATS_LENGTH_SHIFT	5
+
+/* Hamming distance from the received to the decided FSM marker. The
+ * markers are complements, so the distance is at most 4 */
+#define STATS_FSM_BINS		5
+
+/* Counters are only ever incremented from one context each. The block
+ * is copied or cleared with interrupts disabled */
+struct bluebox_stats {
+	/* Dropped frames by cause */
+	uint32_t rx_overflow;		/* RX ring full */
+	uint32_t rx_false_sync;		/* Sync word without valid CUB */
+	uint32_t rx_usb_errors;		/* IN endpoint stream errors */
+	uint32_t tx_oversize;		/* Host frame longer than DATA_LENGTH */
+	uint32_t tx_usb_errors;		/* OUT endpoint stream errors */
+	uint32_t tx_queue_full;		/* OUT endpoint held off by a full queue */
+
+	/* Delivered frames */
+	uint32_t rx_short;
+	uint32_t rx_long;
+#if defined(STATS_HISTOGRAMS)
+	uint16_t fsm_distance[STATS_FSM_BINS];
+	uint16_t length[STATS_LENGTH_BINS];
+	uint16_t rssi[STATS_RSSI_BINS];
+#endif
+
+	/* SPDR loaded after the next TX byte had started */
+	uint32_t tx_spi_late;
+
+	/* Raw mode bytes dropped on a full ring */
+	uint32_t raw_lost;
+
+	/* Training symbols added while frame data was still arriving */
+	uint32_t tx_training_stretch;
+
+	/* OUT transfers abandoned after TX_FILL_TIMEOUT_MS */
+	uint32_t tx_fill_timeout;
+
+	/* Frames that ended before their RSSI and AFC were read, they are
+	 * not in the RSSI histogram */
+	uint32_t rx_no_readback;
+};
+
+extern struct bluebox_stats stats;
+
+/* Histogram bins saturate instead of wrapping */
+static inline void stats_bin_inc(uint16_t *bin)
+{
+	if (*bin != UINT16_MAX)
+		(*bin)++;
+}
+
+static inline void stats_rx_frame(uint16_t size, int16_t rssi, bool readback, uint8_t fsm_distance, bool long_frame)
+{
+#if defined(STATS_HISTOGRAMS)
+	int16_t rssi_bin = (rssi - STATS_RSSI_MIN) >> STATS_RSSI_SHIFT;
+	uint16_t length_bin = size >> STATS_LENGTH_SHIFT;
+
+	if (rssi_bin < 0)
+		rssi_bin = 0;
+	else if (rssi_bin >= STATS_RSSI_BINS)
+		rssi_bin = STATS_RSSI_BINS - 1;
+
+	if (length_bin >= STATS_LENGTH_BINS)
+		length_bin = STATS_LENGTH_BINS - 1;
+
+	if (fsm_distance >= STATS_FSM_BINS)
+		fsm_distance = STATS_FSM_BINS - 1;
+#endif
+
+	if (long_frame)
+		stats.rx_long++;
+	else
+		stats.rx_short++;
+
+	if (!readback)
+		stats.rx_no_readback++;
+
+#if defined(STATS_HISTOGRAMS)
+	if (readback)
+		stats_bin_inc(&stats.rssi[rssi_bin]);
+	stats_bin_inc(&stats.length[length_bin]);
+	stats_bin_inc(&stats.fsm_distance[fsm_distance]);
+#endif
+}
+
+#endif /* _STATS_H_ */
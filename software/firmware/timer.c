@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2012 Jeppe Ledet-Pedersen <jlp@satlab.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "bluebox.h"
+#include "timer.h"
+#include "ptt.h"
+#include "csma.h"
+#include "sched.h"
+
+#if (F_CPU != 16000000)
+#error Timer1 timestamp scaling assumes a 16 MHz clock
+#endif
+
+/* Timer1 overflows since power on. Together with TCNT1 at F_CPU/8 this
+ * forms a free running counter of half microseconds */
+static volatile uint32_t timer1_ovf = 0;
+
+/* Timer0 ticks since power on */
+static volatile uint32_t timer_jiffies = 0;
+
+void timer_init(void)
+{
+	/* Timer0 in CTC mode with F_CPU/64 prescaler */
+	TCCR0A = _BV(WGM01);
+	TCCR0B = _BV(CS01) | _BV(CS00);
+	OCR0A = (F_CPU / 64 / TIMER_HZ) - 1;
+	TIMSK0 |= _BV(OCIE0A);
+
+	/* Timer1 free running with F_CPU/TIMER_TICK_CYCLES prescaler */
+	TCCR1A = 0;
+	TCCR1B = _BV(CS11);
+	TIMSK1 |= _BV(TOIE1);
+}
+
+/* Microseconds since power on, wraps every 71 minutes. Safe to call from
+ * interrupt context */
+uint32_t timer_us(void)
+{
+	uint8_t sreg = SREG;
+	uint32_t ovf;
+	uint16_t count;
+
+	cli();
+	count = TCNT1;
+	ovf = timer1_ovf;
+
+	/* Account for an overflow that has not been serviced yet */
+	if ((TIFR1 & _BV(TOV1)) && count < 0x8000)
+		ovf++;
+	SREG = sreg;
+
+	return (ovf << 15) | (count >> 1);
+}
+
+/* Milliseconds since power on */
+uint32_t timer_ms(void)
+{
+	uint8_t sreg = SREG;
+	uint32_t ms;
+
+	cli();
+	ms = timer_jiffies;
+	SREG = sreg;
+
+	return ms;
+}
+
+ISR(TIMER1_OVF_vect)
+{
+	timer1_ovf++;
+}
+
+ISR(TIMER0_COMPA_vect)
+{
+	timer_jiffies++;
+	ptt_tick();
+	csma_tick();
+	sched_post(EVENT_TICK);
+}